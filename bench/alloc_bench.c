@@ -0,0 +1,137 @@
+// Throughput and memory footprint of reallocate for the allocation patterns of the VM.
+//
+//   churn:  a working set of small blocks (8 to 256 bytes, mostly object sized) where a random block is
+//           freed and replaced by one of another random size, the way short lived objects come and go.
+//   arrays: many arrays grown by doubling from 8 entries, the way chunks, value arrays and tables grow.
+//   holes:  a million small blocks with every other one freed and the holes refilled.
+//
+// Build once with -DALLOCATOR=pool and once with -DALLOCATOR=libc. The libc build can be run against
+// other allocators with LD_PRELOAD, e.g. LD_PRELOAD=libjemalloc.so bench/alloc_bench.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "../modules/memory.h"
+#include "../modules/vm.h"
+
+#define WORKING_SET (1 << 16)
+#define CHURN_OPS (1 << 24)
+#define ARRAYS (1 << 12)
+#define ARRAY_MAX 4096
+#define HOLES (1 << 20)
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static uint64_t state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t randomInt() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t)state;
+}
+
+// Three quarters of the blocks are the size of an object header plus a little, the rest up to 256 bytes.
+static size_t randomSize() {
+    uint32_t r = randomInt();
+    if ((r & 3) != 0) return 24 + (r >> 8) % 40;
+    return 8 + (r >> 8) % 249;
+}
+
+static void report(const char* name, double elapsed, long ops, long rssBefore) {
+    printf("%-7s %8.1f ns/op  peak RSS +%ld KiB\n", name, elapsed / ops * 1e9, peakRssKb() - rssBefore);
+}
+
+static void churn() {
+    void** blocks = malloc(sizeof(void*) * WORKING_SET);
+    size_t* sizes = malloc(sizeof(size_t) * WORKING_SET);
+    long rss = peakRssKb();
+
+    double start = seconds();
+    for (int i = 0; i < WORKING_SET; i++) {
+        sizes[i] = randomSize();
+        blocks[i] = reallocate(NULL, 0, sizes[i]);
+    }
+    for (int i = 0; i < CHURN_OPS; i++) {
+        int slot = randomInt() % WORKING_SET;
+        reallocate(blocks[slot], sizes[slot], 0);
+        sizes[slot] = randomSize();
+        blocks[slot] = reallocate(NULL, 0, sizes[slot]);
+        *(char*)blocks[slot] = (char)i;
+    }
+    double elapsed = seconds() - start;
+    report("churn", elapsed, CHURN_OPS, rss);
+
+    for (int i = 0; i < WORKING_SET; i++) reallocate(blocks[i], sizes[i], 0);
+    free(blocks);
+    free(sizes);
+}
+
+static void arrays() {
+    Value** values = malloc(sizeof(Value*) * ARRAYS);
+    long rss = peakRssKb();
+    long ops = 0;
+
+    double start = seconds();
+    for (int i = 0; i < ARRAYS; i++) {
+        int capacity = 0;
+        values[i] = NULL;
+        int count = 8 << (randomInt() % 10);
+        if (count > ARRAY_MAX) count = ARRAY_MAX;
+        for (int n = 0; n < count; n++) {
+            if (n == capacity) {
+                int oldCapacity = capacity;
+                capacity = GROW_CAPACITY(capacity);
+                values[i] = GROW_ARRAY(Value, values[i], oldCapacity, capacity);
+                ops++;
+            }
+            values[i][n] = NUMBER_VAL(n);
+        }
+        FREE_ARRAY(Value, values[i], capacity);
+        ops++;
+    }
+    double elapsed = seconds() - start;
+    report("arrays", elapsed, ops, rss);
+    free(values);
+}
+
+static void holes() {
+    void** blocks = malloc(sizeof(void*) * HOLES);
+    long rss = peakRssKb();
+
+    double start = seconds();
+    for (int i = 0; i < HOLES; i++) blocks[i] = reallocate(NULL, 0, 40);
+    for (int i = 0; i < HOLES; i += 2) reallocate(blocks[i], 40, 0);
+    for (int i = 0; i < HOLES; i += 2) blocks[i] = reallocate(NULL, 0, 40);
+    double elapsed = seconds() - start;
+    report("holes", elapsed, HOLES * 2, rss);
+
+    for (int i = 0; i < HOLES; i++) reallocate(blocks[i], 40, 0);
+    free(blocks);
+}
+
+int main() {
+    VM* vm = initVM();
+#ifdef POOL_ALLOCATOR
+    printf("pool allocator\n");
+#else
+    printf("libc allocator\n");
+#endif
+    churn();
+    arrays();
+    holes();
+    freeVM(vm);
+    return 0;
+}
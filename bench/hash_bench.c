@@ -0,0 +1,116 @@
+// String hashing throughput, and Table lookups under inputs built to collide.
+//
+// The first part hashes buffers of several lengths with hashString and with the FNV-1a hash it replaced.
+// The second part builds keys whose FNV-1a hashes all share their low 12 bits, so under FNV-1a they land
+// in the same bucket at every table size up to 4096 entries, and times lookups of those keys with each
+// hash. Random keys are timed as a baseline.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../modules/vm.h"
+#include "../modules/object.h"
+#include "../modules/strings.h"
+#include "../modules/table.h"
+
+#define HASH_BYTES (1 << 27)
+#define ATTACK_KEYS 2000
+#define ATTACK_BITS 12
+#define LOOKUP_ROUNDS 20
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t fnv1a(const char* text, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void throughput(VM* vm) {
+    static char buffer[4096];
+    for (int i = 0; i < (int)sizeof(buffer); i++) buffer[i] = (char)('a' + i % 26);
+
+    printf("%7s  %12s  %12s   (ns per hash)\n", "length", "fnv1a", "hashString");
+    int lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096};
+    for (int i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); i++) {
+        int length = lengths[i];
+        int count = HASH_BYTES / length;
+        volatile uint32_t sink = 0;
+
+        double start = seconds();
+        for (int j = 0; j < count; j++) sink += fnv1a(buffer + (j & 7), length - (j & 7 ? 1 : 0));
+        double fnv = seconds() - start;
+
+        start = seconds();
+        for (int j = 0; j < count; j++) sink += hashString(vm->hashSeed, buffer + (j & 7), length - (j & 7 ? 1 : 0));
+        double seeded = seconds() - start;
+
+        printf("%7d  %12.1f  %12.1f\n", length, fnv / count * 1e9, seeded / count * 1e9);
+    }
+}
+
+static double lookups(ObjString** keys, int count) {
+    Table t;
+    initTable(&t);
+    for (int i = 0; i < count; i++) tableSet(&t, keys[i], NUMBER_VAL(i));
+
+    Value value;
+    volatile int found = 0;
+    double start = seconds();
+    for (int round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (int i = 0; i < count; i++) found += tableGet(&t, keys[i], &value);
+    }
+    double elapsed = seconds() - start;
+
+    freeTable(&t);
+    return elapsed / ((double)count * LOOKUP_ROUNDS) * 1e9;
+}
+
+static void collisions(VM* vm) {
+    ObjString* attack[ATTACK_KEYS];
+    ObjString* random[ATTACK_KEYS];
+    char buffer[32];
+    uint32_t mask = (1u << ATTACK_BITS) - 1;
+
+    int found = 0;
+    for (long i = 0; found < ATTACK_KEYS; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "k%ld", i);
+        if ((fnv1a(buffer, length) & mask) == 0) attack[found++] = copyString(vm, buffer, length);
+    }
+    for (int i = 0; i < ATTACK_KEYS; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "r%d", rand());
+        random[i] = copyString(vm, buffer, length);
+    }
+
+    double seededAttack = lookups(attack, ATTACK_KEYS);
+    double seededRandom = lookups(random, ATTACK_KEYS);
+
+    // Tables only ever look at ObjString.hash, so rehashing the keys in place replays the old behaviour.
+    for (int i = 0; i < ATTACK_KEYS; i++) {
+        attack[i]->hash = fnv1a(attack[i]->chars, attack[i]->length);
+        random[i]->hash = fnv1a(random[i]->chars, random[i]->length);
+    }
+    double fnvAttack = lookups(attack, ATTACK_KEYS);
+    double fnvRandom = lookups(random, ATTACK_KEYS);
+
+    printf("\n%d keys  %12s  %12s   (ns per lookup)\n", ATTACK_KEYS, "fnv1a", "hashString");
+    printf("%9s  %12.1f  %12.1f\n", "random", fnvRandom, seededRandom);
+    printf("%9s  %12.1f  %12.1f\n", "colliding", fnvAttack, seededAttack);
+}
+
+int main() {
+    VM* vm = initVM();
+    throughput(vm);
+    collisions(vm);
+    freeVM(vm);
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Latency of single Table inserts while a table grows.
+//
+// Times every insert into a fresh table on its own, so the inserts that trigger a resize show up in the
+// tail percentiles instead of being averaged away. The same number of empty intervals is timed first, its
+// maximum is how long the machine can stall a thread without any help from the table.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../modules/vm.h"
+#include "../modules/object.h"
+#include "../modules/strings.h"
+#include "../modules/table.h"
+
+#define KEYS (1 << 21)
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, int count, double p) {
+    return sorted[(int)((count - 1) * p)];
+}
+
+int main() {
+    VM* vm = initVM();
+
+    ObjString** keys = malloc(sizeof(ObjString*) * KEYS);
+    char buffer[32];
+    for (int i = 0; i < KEYS; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "key%d", i);
+        keys[i] = copyString(vm, buffer, length);
+    }
+
+    double* latencies = malloc(sizeof(double) * KEYS);
+    double floor = 0;
+    for (int i = 0; i < KEYS; i++) {
+        double start = seconds();
+        double elapsed = seconds() - start;
+        if (elapsed > floor) floor = elapsed;
+    }
+    Table t;
+    initTable(&t);
+
+    double total = seconds();
+    for (int i = 0; i < KEYS; i++) {
+        double start = seconds();
+        tableSet(&t, keys[i], NUMBER_VAL(i));
+        latencies[i] = seconds() - start;
+    }
+    total = seconds() - total;
+
+    qsort(latencies, KEYS, sizeof(double), compareDoubles);
+    printf("%d inserts in %.1f ms (ns): p50 %.0f  p99 %.0f  p999 %.0f  p9999 %.0f  max %.0f\n", KEYS, total * 1e3,
+           percentile(latencies, KEYS, 0.50) * 1e9, percentile(latencies, KEYS, 0.99) * 1e9,
+           percentile(latencies, KEYS, 0.999) * 1e9, percentile(latencies, KEYS, 0.9999) * 1e9,
+           latencies[KEYS - 1] * 1e9);
+    printf("empty interval max %.0f ns\n", floor * 1e9);
+
+    freeTable(&t);
+    free(latencies);
+    free(keys);
+    freeVM(vm);
+    return 0;
+}
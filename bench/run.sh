@@ -0,0 +1,28 @@
+#!/bin/sh
+# Builds clox once per configuration and times every benchmark script with each build.
+#
+#   bench/run.sh                          # NaN boxing vs tagged union
+#   bench/run.sh "-DNAN_BOXING=OFF" ""    # any list of cmake option sets
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+[ $# -eq 0 ] && set -- "-DNAN_BOXING=OFF" "-DNAN_BOXING=ON"
+
+n=0
+for config in "$@"; do
+    n=$((n + 1))
+    build="$ROOT/_bench_build/$n"
+    rm -f "$build/CMakeCache.txt"
+    cmake -S "$ROOT" -B "$build" -DCMAKE_BUILD_TYPE=Release $config > /dev/null
+    cmake --build "$build" > /dev/null 2>&1
+
+    echo "== ${config:-default}"
+    for script in "$ROOT"/bench/*.lox; do
+        start=$(date +%s.%N)
+        "$build/clox" "$script" > /dev/null
+        end=$(date +%s.%N)
+        awk -v name="$(basename "$script")" -v t="$end - $start" \
+            'BEGIN { split(t, p, " - "); printf "%-20s %8.3fs\n", name, p[1] - p[2] }'
+    done
+done
@@ -0,0 +1,62 @@
+// Allocation throughput and memory footprint for many short strings.
+//
+// Creates runtime strings of 2 to 40 characters through concatenateStrings and reports the time per string
+// and the peak RSS of the process. Build with -DSTRING_ARENA=OFF to compare against one malloc per string.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "../modules/vm.h"
+#include "../modules/object.h"
+#include "../modules/strings.h"
+
+#define STRINGS (1 << 22)
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main() {
+    VM* vm = initVM();
+    ObjString* pieces[20];
+    char buffer[32];
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j <= i; j++) buffer[j] = (char)('a' + j);
+        pieces[i] = copyString(vm, buffer, i + 1);
+    }
+
+    ObjString** strings = malloc(sizeof(ObjString*) * STRINGS);
+    long before = peakRssKb();
+
+    double start = seconds();
+    for (int i = 0; i < STRINGS; i++) {
+        strings[i] = concatenateStrings(vm, pieces[i % 20], pieces[(i / 20) % 20]);
+    }
+    double elapsed = seconds() - start;
+
+    long bytes = 0;
+    for (int i = 0; i < STRINGS; i++) bytes += strings[i]->length;
+
+#ifdef STRING_ARENA
+    const char* mode = "arena";
+#else
+    const char* mode = "malloc";
+#endif
+    printf("%s: %d strings (%.1f chars on average) in %.1f ns each, RSS grew by %ld KiB (%.1f bytes per string)\n",
+           mode, STRINGS, (double)bytes / STRINGS, elapsed / STRINGS * 1e9, peakRssKb() - before,
+           (peakRssKb() - before) * 1024.0 / STRINGS);
+
+    free(strings);
+    freeVM(vm);
+    return 0;
+}
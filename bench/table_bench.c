@@ -0,0 +1,82 @@
+// Insert and lookup throughput of Table at several load factors.
+//
+// Every run fills a fresh table with `count` interned keys, then looks each of them up (hits) and looks
+// up as many keys that were never inserted (misses). The counts are chosen so the final table sits at
+// different fractions of its capacity.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../modules/vm.h"
+#include "../modules/object.h"
+#include "../modules/strings.h"
+#include "../modules/table.h"
+
+#define ROUNDS 20
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static ObjString** makeKeys(VM* vm, const char* prefix, int count) {
+    ObjString** keys = malloc(sizeof(ObjString*) * count);
+    char buffer[32];
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+        keys[i] = copyString(vm, buffer, length);
+    }
+    return keys;
+}
+
+static void run(VM* vm, int count) {
+    ObjString** keys = makeKeys(vm, "key", count);
+    ObjString** missing = makeKeys(vm, "missing", count);
+
+    double insert = 0, hit = 0, miss = 0;
+    double load = 0;
+    Value value;
+    volatile int found = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        Table t;
+        initTable(&t);
+
+        double start = seconds();
+        for (int i = 0; i < count; i++) tableSet(&t, keys[i], NUMBER_VAL(i));
+        insert += seconds() - start;
+
+        start = seconds();
+        for (int i = 0; i < count; i++) found += tableGet(&t, keys[i], &value);
+        hit += seconds() - start;
+
+        start = seconds();
+        for (int i = 0; i < count; i++) found += tableGet(&t, missing[i], &value);
+        miss += seconds() - start;
+
+        load = (double)t.count / t.capacity;
+        freeTable(&t);
+    }
+
+    double ops = (double)count * ROUNDS;
+    printf("%9d  %5.2f  %8.1f  %8.1f  %8.1f\n", count, load, insert / ops * 1e9, hit / ops * 1e9, miss / ops * 1e9);
+
+    free(keys);
+    free(missing);
+}
+
+int main() {
+    VM* vm = initVM();
+    int capacity = 1 << 20;
+
+    printf("%9s  %5s  %8s  %8s  %8s   (ns per operation)\n", "keys", "load", "insert", "hit", "miss");
+    double loads[] = {0.40, 0.50, 0.55, 0.70, 0.74};
+    for (int i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++) {
+        run(vm, (int)(capacity * loads[i]));
+    }
+
+    freeVM(vm);
+    return 0;
+}
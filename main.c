@@ -5,6 +5,7 @@
 #include "modules/common.h"
 #include "modules/chunk.h"
 #include "modules/debug.h"
+#include "modules/memory.h"
 #include "modules/vm.h"
 
 static void repl(VM* vm) {
@@ -54,29 +55,69 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
-static void runFile(VM* vm, const char* path) {
+// Returns the exit status, main still has to print the statistics when the script fails.
+static int runFile(VM* vm, const char* path) {
     char* source = readFile(path);
     InterpretResult result = interpret(vm, source);
 
     free(source);
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [--trace] [--dump-bytecode] [--table-stats] [--gc-stats] [--mem-stats] [--gc-budget=<us>] [path]\n"
+                    "  --gc-budget=<us>  longest pause to aim for with INCREMENTAL_GC (default 500), minor collections\n"
+                    "                    included; scanning the stack and globals isn't bounded by it\n");
+    exit(64);
 }
 
 int main(int argc, const char* argv[]) {
     VM* vm = initVM();
+    const char* path = NULL;
+    bool tableStats = false;
+    bool gcStats = false;
+    bool memStats = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            vm->traceExecution = true;
+        } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            vm->printCode = true;
+        } else if (strcmp(argv[i], "--table-stats") == 0) {
+            tableStats = true;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gcStats = true;
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            memStats = true;
+        } else if (strncmp(argv[i], "--gc-budget=", 12) == 0) {
+            char* end;
+            long budget = strtol(argv[i] + 12, &end, 10);
+            if (*end != '\0' || budget <= 0 || budget > INT32_MAX) usage();
+            setGCPauseBudget(vm, (int)budget);
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
 
-    if (argc == 1) {
+    int status = 0;
+    if (path == NULL) {
         repl(vm);
-    } else if (argc == 2) {
-        runFile(vm, argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        status = runFile(vm, path);
     }
 
+    if (tableStats) {
+        printTableStats("strings", &vm->strings);
+        printTableStats("globals", &vm->globals);
+    }
+    if (gcStats) printGCStats(vm);
+    if (memStats) printMemStats(vm);
 
     freeVM(vm);
-    return 0;
+    return status;
 }
 
@@ -0,0 +1,79 @@
+//
+// Bump-pointer allocation for small objects, used for ObjString.
+//
+
+#include "arena.h"
+#include "memory.h"
+
+#define BLOCK_HEADER_SIZE ((sizeof(ArenaBlock) + 7) & ~(size_t)7)
+
+// Steps of 8 bytes where short strings are most common, the alignment ObjString needs.
+static const size_t classSizes[ARENA_CLASSES] = {40, 48, 56, 64, 80, 96, 112, 128, 192, 256};
+
+static int sizeClass(size_t size) {
+    int c = 0;
+    while (classSizes[c] < size) c++;
+    return c;
+}
+
+static ArenaBlock* blockOf(void* pointer) {
+    return (ArenaBlock*)((uintptr_t)pointer & ~(uintptr_t)(ARENA_BLOCK_SIZE - 1));
+}
+
+static char* blockEnd(ArenaBlock* block) {
+    return (char*)block + ARENA_BLOCK_SIZE;
+}
+
+void initArena(Arena* arena) {
+    arena->blocks = NULL;
+    for (int i = 0; i < ARENA_CLASSES; i++) {
+        arena->current[i] = NULL;
+        arena->top[i] = NULL;
+    }
+}
+
+static void releaseBlock(Arena* arena, ArenaBlock* block) {
+    if (block->prev != NULL) block->prev->next = block->next;
+    else arena->blocks = block->next;
+    if (block->next != NULL) block->next->prev = block->prev;
+
+    freeAligned(block, ARENA_BLOCK_SIZE);
+}
+
+void freeArena(Arena* arena) {
+    while (arena->blocks != NULL) releaseBlock(arena, arena->blocks);
+    initArena(arena);
+}
+
+static void newBlock(Arena* arena, int c) {
+    ArenaBlock* old = arena->current[c];
+    if (old != NULL && old->live == 0) releaseBlock(arena, old);
+
+    ArenaBlock* block = allocateAligned(ARENA_BLOCK_SIZE, ARENA_BLOCK_SIZE);
+    block->sizeClass = c;
+    block->live = 0;
+    block->prev = NULL;
+    block->next = arena->blocks;
+    if (arena->blocks != NULL) arena->blocks->prev = block;
+    arena->blocks = block;
+
+    arena->current[c] = block;
+    arena->top[c] = (char*)block + BLOCK_HEADER_SIZE;
+}
+
+void* arenaAllocate(Arena* arena, size_t size) {
+    int c = sizeClass(size);
+    size_t slot = classSizes[c];
+    if (arena->top[c] == NULL || arena->top[c] + slot > blockEnd(arena->current[c])) newBlock(arena, c);
+
+    void* pointer = arena->top[c];
+    arena->top[c] += slot;
+    arena->current[c]->live++;
+    return pointer;
+}
+
+void arenaRelease(Arena* arena, void* pointer) {
+    ArenaBlock* block = blockOf(pointer);
+    block->live--;
+    if (block->live == 0 && block != arena->current[block->sizeClass]) releaseBlock(arena, block);
+}
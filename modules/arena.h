@@ -0,0 +1,36 @@
+//
+// Bump-pointer allocation for small objects, used for ObjString.
+//
+
+#ifndef CLOX_ARENA_H
+#define CLOX_ARENA_H
+
+#include "common.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_CLASSES 10
+#define ARENA_MAX_SIZE 256 // Bigger allocations don't belong in an arena.
+
+// Every block holds slots of a single size class and is aligned to ARENA_BLOCK_SIZE, so the block of any
+// slot can be found by masking its address. Slots are never reused, a block is released as a whole once
+// every slot carved from it has been released.
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    struct ArenaBlock* next;
+    int sizeClass;
+    int live;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks;
+    // Per size class, the block slots are carved from and the next free slot in it.
+    ArenaBlock* current[ARENA_CLASSES];
+    char* top[ARENA_CLASSES];
+} Arena;
+
+void initArena(Arena* arena);
+void freeArena(Arena* arena);
+void* arenaAllocate(Arena* arena, size_t size);
+void arenaRelease(Arena* arena, void* pointer);
+
+#endif //CLOX_ARENA_H
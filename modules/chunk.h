@@ -3,7 +3,6 @@
 
 #include "common.h"
 #include "value.h"
-#include "table.h"
 
 typedef enum {
     OP_CONSTANT,
@@ -30,20 +29,30 @@ typedef enum {
     OP_JUMP,
     OP_LOOP,
     OP_RETURN,
+    // Wide forms with a 24-bit operand, used once the 8-bit one runs out.
+    OP_CONSTANT_LONG,
+    OP_DEFINE_GLOBAL_LONG,
+    OP_GET_GLOBAL_LONG,
+    OP_SET_GLOBAL_LONG,
+    // Superinstructions, emitted by the compiler in place of common sequences.
+    OP_NOT_EQUAL,             // OP_EQUAL, OP_NOT
+    OP_POP_JUMP_IF_FALSE,     // OP_JUMP_IF_FALSE, OP_POP on both paths
+    OP_JUMP_IF_NOT_LESSER,    // OP_LESSER, OP_POP_JUMP_IF_FALSE
+    OP_ADD_LOCAL_CONSTANT,    // OP_GET_LOCAL x, OP_CONSTANT, OP_ADD, OP_SET_LOCAL x, OP_POP
 } OpCode;
 
+#define UINT24_MAX 0xffffff
+
 typedef struct  {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
-    Table identifiers;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
-int addIdentifier(Chunk* chunk, Value name);
 #endif
\ No newline at end of file
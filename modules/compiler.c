@@ -10,10 +10,8 @@
 #include "scanner.h"
 #include "vm.h"
 #include "strings.h"
-
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
+#include "memory.h"
 
 Compiler* c = NULL;
 Chunk* compilingChunk;
@@ -29,13 +27,19 @@ Parser *initParser() {
     return p;
 }
 
-static void initCompiler(Compiler* compiler, FunctionType type) {
+static void initCompiler(VM* vm, Compiler* compiler, FunctionType type) {
     compiler->function = NULL;
     compiler->type = type;
 
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    compiler->function = newFunction();
+    for (int i = 0; i < 4; i++) compiler->recentInstructions[i] = -1;
+    compiler->constantIndex = NULL;
+    compiler->constantIndexCount = 0;
+    compiler->constantIndexCapacity = 0;
+    compiler->constantUses = NULL;
+    compiler->constantUsesCapacity = 0;
+    compiler->function = newFunction(vm);
     c = compiler;
 
     Local* local = &c->locals[c->localCount++];
@@ -130,13 +134,41 @@ static Chunk* currentChunk() {
     return &c->function->chunk;
 }
 
-static void emitByte(Parser* p, uint8_t byte) {
+static void emitOperand(Parser* p, uint8_t byte) {
     writeChunk(currentChunk(), byte, p->previous.line);
 }
 
+static void emitByte(Parser* p, uint8_t byte) {
+    for (int i = 3; i > 0; i--) c->recentInstructions[i] = c->recentInstructions[i - 1];
+    c->recentInstructions[0] = currentChunk()->count;
+    emitOperand(p, byte);
+}
+
 static void emitBytes(Parser* p, uint8_t byte1, uint8_t byte2) {
     emitByte(p, byte1);
-    emitByte(p, byte2);
+    emitOperand(p, byte2);
+}
+
+static int markJumpTarget() {
+    for (int i = 0; i < 4; i++) c->recentInstructions[i] = -1;
+    return currentChunk()->count;
+}
+
+// Returns the opcode of the n-th most recent instruction, or -1 if it can't be part of a superinstruction.
+static int recentOp(int n) {
+    int offset = c->recentInstructions[n];
+    if (offset < 0) return -1;
+    return currentChunk()->code[offset];
+}
+
+static uint8_t recentOperand(int n, int index) {
+    return currentChunk()->code[c->recentInstructions[n] + 1 + index];
+}
+
+// Drops the n most recent instructions so a superinstruction can be emitted in their place.
+static void dropRecent(int n) {
+    currentChunk()->count = c->recentInstructions[n - 1];
+    for (int i = 0; i < 4; i++) c->recentInstructions[i] = i + n < 4 ? c->recentInstructions[i + n] : -1;
 }
 
 static void emitLoop(Parser* p, int loopStart) {
@@ -145,42 +177,155 @@ static void emitLoop(Parser* p, int loopStart) {
     int offset = currentChunk()->count - loopStart + 2;
     if (offset > UINT16_MAX) error(p, "Loop body too large.");
 
-    emitByte(p, (offset >> 8) & 0xff);
-    emitByte(p, offset & 0xff);
+    emitOperand(p, (offset >> 8) & 0xff);
+    emitOperand(p, offset & 0xff);
 }
 
-static uint8_t makeConstant(Parser* p, Value v) {
-    int constant = addConstant(currentChunk(), v);
-    if (constant > UINT8_MAX) {
-        error(p, "Too many constants in one chunk");
-        return 0;
+// Constants are the same when their representation is, which keeps 0 and -0 apart. The pool only ever
+// holds numbers and strings, whose representation has no padding.
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    return a.type == b.type && memcmp(&a.as, &b.as, sizeof(a.as)) == 0;
+#endif
+}
+
+static uint32_t hashConstant(Value value) {
+    uint64_t bits;
+#ifdef NAN_BOXING
+    bits = value;
+#else
+    memcpy(&bits, &value.as, sizeof(bits));
+    bits ^= (uint64_t)value.type;
+#endif
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static ConstantEntry* findConstantEntry(Value value) {
+    uint32_t mask = c->constantIndexCapacity - 1;
+    for (uint32_t i = hashConstant(value) & mask;; i = (i + 1) & mask) {
+        ConstantEntry* entry = &c->constantIndex[i];
+        if (entry->index < 0 || sameConstant(entry->value, value)) return entry;
+    }
+}
+
+// Rebuilding from the pool instead of rehashing the old entries also forgets constants that folding has
+// taken back out of the pool.
+static void rebuildConstantIndex(int capacity) {
+    FREE_ARRAY(ConstantEntry, c->constantIndex, c->constantIndexCapacity);
+    c->constantIndex = GROW_ARRAY(ConstantEntry, NULL, 0, capacity);
+    c->constantIndexCapacity = capacity;
+    c->constantIndexCount = 0;
+    for (int i = 0; i < capacity; i++) c->constantIndex[i].index = -1;
+
+    ValueArray* constants = &currentChunk()->constants;
+    for (int i = 0; i < constants->count; i++) {
+        ConstantEntry* entry = findConstantEntry(constants->values[i]);
+        if (entry->index >= 0) continue;
+
+        entry->value = constants->values[i];
+        entry->index = i;
+        c->constantIndexCount++;
     }
+}
 
-    return (uint8_t)constant;
+static void freeConstantIndex() {
+    FREE_ARRAY(ConstantEntry, c->constantIndex, c->constantIndexCapacity);
+    FREE_ARRAY(int, c->constantUses, c->constantUsesCapacity);
+    c->constantIndex = NULL;
+    c->constantIndexCapacity = 0;
+    c->constantUses = NULL;
+    c->constantUsesCapacity = 0;
 }
 
-static uint8_t makeIdentifier(Parser* p, Value v) {
-    int constant = addIdentifier(currentChunk(), v);
-    if (constant > UINT8_MAX) {
+static int makeConstant(Parser* p, Value v) {
+    if (c->constantIndexCount + 1 > c->constantIndexCapacity / 2) {
+        rebuildConstantIndex(GROW_CAPACITY(c->constantIndexCapacity));
+    }
+
+    // An entry may point past the end of the pool, or at a different constant, after folding dropped the
+    // constant it was made for.
+    ValueArray* constants = &currentChunk()->constants;
+    ConstantEntry* entry = findConstantEntry(v);
+    int constant = entry->index;
+    if (constant < 0 || constant >= constants->count || !sameConstant(constants->values[constant], v)) {
+        if (entry->index < 0) c->constantIndexCount++;
+        constant = addConstant(currentChunk(), v);
+        entry->value = v;
+        entry->index = constant;
+
+        if (c->constantUsesCapacity < constants->count) {
+            int oldCapacity = c->constantUsesCapacity;
+            c->constantUsesCapacity = GROW_CAPACITY(oldCapacity);
+            c->constantUses = GROW_ARRAY(int, c->constantUses, oldCapacity, c->constantUsesCapacity);
+        }
+        c->constantUses[constant] = 0;
+    }
+    c->constantUses[constant]++;
+
+    if (constant > UINT24_MAX) {
         error(p, "Too many constants in one chunk");
         return 0;
     }
 
-    return (uint8_t)constant;
+    return constant;
 }
 
+// Emits op with a one byte operand when it fits, and longOp with a 24-bit big endian operand otherwise.
+static void emitWithOperand(Parser* p, uint8_t op, uint8_t longOp, int operand) {
+    if (operand <= UINT8_MAX) {
+        emitBytes(p, op, (uint8_t)operand);
+        return;
+    }
+
+    emitByte(p, longOp);
+    emitOperand(p, (operand >> 16) & 0xff);
+    emitOperand(p, (operand >> 8) & 0xff);
+    emitOperand(p, operand & 0xff);
+}
 
 static void emitConstant(Parser* p, Value v) {
-    emitBytes(p, OP_CONSTANT, makeConstant(p, v));
+    emitWithOperand(p, OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(p, v));
 }
 
 static int emitJump(Parser* p, uint8_t instruction) {
     emitByte(p, instruction);
     // We are going to need 16bit instruction to handle jumps of 2¹⁶ bytes of code
-    emitByte(p, 0xff); emitByte(p, 0xff); // 255 because it is easy to use with bitwise operations
+    emitOperand(p, 0xff); emitOperand(p, 0xff); // 255 because it is easy to use with bitwise operations
     return currentChunk()->count - 2;
 }
 
+// Emits the jump that skips a statement when its condition is false. The condition is consumed on both
+// paths, and a trailing `<` is folded into the jump.
+static int emitConditionJump(Parser* p) {
+    if (recentOp(0) == OP_LESSER) {
+        dropRecent(1);
+        return emitJump(p, OP_JUMP_IF_NOT_LESSER);
+    }
+
+    return emitJump(p, OP_POP_JUMP_IF_FALSE);
+}
+
+// Discards the value of an expression statement. `x = x + k` on a local becomes a single instruction.
+static void emitStatementPop(Parser* p) {
+    if (recentOp(3) == OP_GET_LOCAL && recentOp(2) == OP_CONSTANT &&
+        recentOp(1) == OP_ADD && recentOp(0) == OP_SET_LOCAL &&
+        recentOperand(3, 0) == recentOperand(0, 0)) {
+        uint8_t slot = recentOperand(0, 0);
+        uint8_t constant = recentOperand(2, 0);
+        dropRecent(4);
+        emitBytes(p, OP_ADD_LOCAL_CONSTANT, slot);
+        emitOperand(p, constant);
+        return;
+    }
+
+    emitByte(p, OP_POP);
+}
+
 static void patchJump(Parser* p, int offset) {
     int jump = currentChunk()->count - 2 - offset;
     if (jump > UINT16_MAX) {
@@ -189,6 +334,7 @@ static void patchJump(Parser* p, int offset) {
 
     currentChunk()->code[offset] = (jump >> 8) & 0xff;
     currentChunk()->code[offset + 1] = jump & 0xff;
+    markJumpTarget();
 }
 
 static void beginScope() {
@@ -205,15 +351,14 @@ static void endScope(Parser* p) {
     }
 }
 
-static ObjFunction* endCompiler(Parser* p) {
+static ObjFunction* endCompiler(VM* vm, Parser* p) {
     emitByte(p, OP_RETURN);
     ObjFunction* function = c->function;
+    freeConstantIndex();
 
-#ifdef DEBUG_PRINT_CODE
-    if (!p->hadError) {
+    if (vm->printCode && !p->hadError) {
         disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
     }
-#endif
 
     return function;
 }
@@ -229,11 +374,17 @@ static void number(VM* vm, Parser* p, bool _) {
 }
 
 static void string(VM* vm, Parser* p, bool _) {
-    emitConstant(p, OBJ_VAL(copyString(vm, p->previous.start + 1, p->previous.length - 2)));
+    emitConstant(p, stringValue(vm, p->previous.start + 1, p->previous.length - 2));
 }
 
-static uint8_t identifierConstant(VM* vm, Parser* p) {
-    return makeIdentifier(p, OBJ_VAL(copyString(vm, p->previous.start, p->previous.length)));
+static int identifierSlot(VM* vm, Parser* p) {
+    int slot = globalSlot(vm, copyString(vm, p->previous.start, p->previous.length));
+    if (slot > UINT24_MAX) {
+        error(p, "Too many global variables.");
+        return 0;
+    }
+
+    return slot;
 }
 
 static bool identifiersEqual(Token* a, Token* b) {
@@ -255,22 +406,24 @@ static int resolveLocal(Compiler* compiler, Parser* p, Token* name) {
 }
 
 static void namedVariable(VM* vm, Parser* p, bool canAssign) {
-    uint8_t getOp, setOp;
+    uint8_t getOp, setOp, getLongOp, setLongOp;
     int arg = resolveLocal(c, p, &p->previous);
     if (arg != -1) {
-        getOp = OP_GET_LOCAL;
-        setOp = OP_SET_LOCAL;
+        getOp = getLongOp = OP_GET_LOCAL;
+        setOp = setLongOp = OP_SET_LOCAL;
     } else {
-        arg = identifierConstant(vm, p);
+        arg = identifierSlot(vm, p);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
+        getLongOp = OP_GET_GLOBAL_LONG;
+        setLongOp = OP_SET_GLOBAL_LONG;
     }
 
     if (canAssign && match(p, TOKEN_EQUAL)) {
         expression(vm, p);
-        emitBytes(p, setOp, (uint8_t)arg);
+        emitWithOperand(p, setOp, setLongOp, arg);
     } else {
-        emitBytes(p, getOp, (uint8_t)arg);
+        emitWithOperand(p, getOp, getLongOp, arg);
     }
 }
 
@@ -305,22 +458,22 @@ static void markInitialized() {
     c->locals[c->localCount - 1].depth = c->scopeDepth;
 }
 
-static void defineVariable(VM* vm, Parser* p, uint8_t var) {
+static void defineVariable(VM* vm, Parser* p, int var) {
     if (c->scopeDepth > 0) {
         markInitialized();
         return;
     }
 
-    emitBytes(p, OP_DEFINE_GLOBAL, var);
+    emitWithOperand(p, OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, var);
 }
 
-static uint8_t parseVariable(VM* vm, Parser* p, const char* errorMessage) {
+static int parseVariable(VM* vm, Parser* p, const char* errorMessage) {
     consume(p, TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable(p);
     if (c->scopeDepth > 0) return 0;
 
-    return identifierConstant(vm, p);
+    return identifierSlot(vm, p);
 }
 
 
@@ -328,13 +481,142 @@ static void variable(VM* vm, Parser* p, bool canAssign) {
     namedVariable(vm, p, canAssign);
 }
 
+// Constant folding: when the operands just emitted are literals, the operation is evaluated here with the
+// same helpers run() uses and replaced by a single literal. Anything run() would report as an error is
+// left for run() to report.
+static int recentConstantIndex(int n) {
+    switch (recentOp(n)) {
+        case OP_CONSTANT:      return recentOperand(n, 0);
+        case OP_CONSTANT_LONG: return (recentOperand(n, 0) << 16) | (recentOperand(n, 1) << 8) | recentOperand(n, 2);
+        default:               return -1;
+    }
+}
+
+static bool recentLiteral(int n, Value* value) {
+    switch (recentOp(n)) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            *value = currentChunk()->constants.values[recentConstantIndex(n)];
+            return true;
+        case OP_TRUE:     *value = BOOL_VAL(true); return true;
+        case OP_FALSE:    *value = BOOL_VAL(false); return true;
+        case OP_NIL:      *value = NIL_VAL; return true;
+        default:          return false;
+    }
+}
+
+static void dropLiterals(int n) {
+    for (int i = 0; i < n; i++) {
+        int index = recentConstantIndex(i);
+        if (index >= 0) c->constantUses[index]--;
+    }
+
+    // Constants at the end of the pool that nothing uses anymore can leave it with these instructions.
+    ValueArray* constants = &currentChunk()->constants;
+    while (constants->count > 0 && c->constantUses[constants->count - 1] == 0) constants->count--;
+    dropRecent(n);
+}
+
+static void emitLiteral(Parser* p, Value value) {
+    if (IS_NIL(value))       emitByte(p, OP_NIL);
+    else if (IS_BOOL(value)) emitByte(p, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    else                     emitConstant(p, value);
+}
+
+static bool foldBinary(VM* vm, uint8_t op, Value* result) {
+    Value a, b;
+    if (!recentLiteral(1, &a) || !recentLiteral(0, &b)) return false;
+
+    switch (op) {
+        case OP_ADD:
+            if (IS_NUMBER(a) && IS_NUMBER(b)) *result = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+            else if (IS_ANY_STRING(a) && IS_ANY_STRING(b)) *result = canonicalString(vm, concatenate(vm, a, b));
+            else return false;
+            return true;
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+            double x = AS_NUMBER(a), y = AS_NUMBER(b);
+            *result = NUMBER_VAL(op == OP_SUBTRACT ? x - y : op == OP_MULTIPLY ? x * y : x / y);
+            return true;
+        }
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_LESSER:
+            if (VALUE_TYPE(a) != VALUE_TYPE(b)) return false;
+            if (op == OP_EQUAL)          *result = BOOL_VAL(valuesEqual(a, b));
+            else if (op == OP_NOT_EQUAL) *result = BOOL_VAL(!valuesEqual(a, b));
+            else if (op == OP_GREATER)   *result = BOOL_VAL(valuesGreater(a, b));
+            else                         *result = BOOL_VAL(valuesLesser(a, b));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void emitBinary(VM* vm, Parser* p, uint8_t op) {
+    Value result;
+    if (foldBinary(vm, op, &result)) {
+        dropLiterals(2);
+        emitLiteral(p, result);
+        return;
+    }
+
+    emitByte(p, op);
+}
+
+static bool producesBool(int op) {
+    switch (op) {
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_LESSER:
+        case OP_NOT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void emitNot(Parser* p) {
+    Value value;
+    if (recentLiteral(0, &value)) {
+        dropLiterals(1);
+        emitLiteral(p, BOOL_VAL(isFalsey(value)));
+        return;
+    }
+
+    // !!x is x when x is already a boolean.
+    if (recentOp(0) == OP_NOT && producesBool(recentOp(1))) {
+        dropRecent(1);
+        return;
+    }
+
+    emitByte(p, OP_NOT);
+}
+
+static void emitNegate(Parser* p) {
+    Value value;
+    if (recentLiteral(0, &value) && IS_NUMBER(value)) {
+        dropLiterals(1);
+        emitConstant(p, NUMBER_VAL(-AS_NUMBER(value)));
+        return;
+    }
+
+    emitByte(p, OP_NEGATE);
+}
+
 static void unary(VM* vm, Parser* p, bool _) {
     TokenType operatorType = p->previous.type;
 
     parsePrecedence(vm, p, PREC_UNARY);
 
-    if (operatorType == TOKEN_MINUS)     emitByte(p, OP_NEGATE);
-    else if (operatorType == TOKEN_BANG) emitByte(p, OP_NOT);
+    if (operatorType == TOKEN_MINUS)     emitNegate(p);
+    else if (operatorType == TOKEN_BANG) emitNot(p);
 }
 
 static void binary(VM* vm, Parser* p, bool _) {
@@ -343,16 +625,16 @@ static void binary(VM* vm, Parser* p, bool _) {
     parsePrecedence(vm, p, (Precedence)rule->precedence + 1);
 
     switch (operatorType) {
-        case TOKEN_PLUS: emitByte(p, OP_ADD); break;
-        case TOKEN_MINUS: emitByte(p, OP_SUBTRACT); break;
-        case TOKEN_STAR: emitByte(p, OP_MULTIPLY); break;
-        case TOKEN_SLASH: emitByte(p, OP_DIVIDE); break;
-        case TOKEN_EQUAL_EQUAL: emitByte(p, OP_EQUAL); break;
-        case TOKEN_BANG_EQUAL: emitByte(p,OP_EQUAL); emitByte(p,OP_NOT); break;
-        case TOKEN_GREATER: emitByte(p, OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitByte(p,OP_LESSER); emitByte(p,OP_NOT); break;
-        case TOKEN_LESS: emitByte(p, OP_LESSER); break;
-        case TOKEN_LESS_EQUAL: emitByte(p,OP_GREATER); emitByte(p,OP_NOT); break;
+        case TOKEN_PLUS: emitBinary(vm, p, OP_ADD); break;
+        case TOKEN_MINUS: emitBinary(vm, p, OP_SUBTRACT); break;
+        case TOKEN_STAR: emitBinary(vm, p, OP_MULTIPLY); break;
+        case TOKEN_SLASH: emitBinary(vm, p, OP_DIVIDE); break;
+        case TOKEN_EQUAL_EQUAL: emitBinary(vm, p, OP_EQUAL); break;
+        case TOKEN_BANG_EQUAL: emitBinary(vm, p, OP_NOT_EQUAL); break;
+        case TOKEN_GREATER: emitBinary(vm, p, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emitBinary(vm, p, OP_LESSER); emitNot(p); break;
+        case TOKEN_LESS: emitBinary(vm, p, OP_LESSER); break;
+        case TOKEN_LESS_EQUAL: emitBinary(vm, p, OP_GREATER); emitNot(p); break;
         default: return; // Unreachable
     }
 }
@@ -470,7 +752,7 @@ static void blockStatement(VM* vm, Parser* p) {
 static void expressionStatement(VM* vm, Parser* p) {
     expression(vm, p);
     consume(p, TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(p, OP_POP);
+    emitStatementPop(p);
 }
 
 static void printStatement(VM* vm, Parser* p) {
@@ -485,13 +767,11 @@ static void ifStatement(VM* vm, Parser* p) {
     consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
     beginScope();
-    int thenJump = emitJump(p, OP_JUMP_IF_FALSE);
-    emitByte(p, OP_POP);
+    int thenJump = emitConditionJump(p);
     statement(vm, p);
 
     int elseJump = emitJump(p, OP_JUMP);
     patchJump(p, thenJump);
-    emitByte(p, OP_POP);
 
     if (match(p, TOKEN_ELSE)) statement(vm, p);
     patchJump(p, elseJump);
@@ -500,23 +780,21 @@ static void ifStatement(VM* vm, Parser* p) {
 }
 
 static void whileStatement(VM* vm, Parser* p) {
-    int loopStart = currentChunk()->count;
+    int loopStart = markJumpTarget();
 
     consume(p, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
     expression(vm, p);
     consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int exitJump = emitJump(p, OP_JUMP_IF_FALSE);
-    emitByte(p, OP_POP);
+    int exitJump = emitConditionJump(p);
     statement(vm, p);
     emitLoop(p, loopStart);
 
     patchJump(p, exitJump);
-    emitByte(p, OP_POP);
 }
 
 static void varDeclaration(VM* vm, Parser* p) {
-    uint8_t name = parseVariable(vm, p, "Expect variable name");
+    int name = parseVariable(vm, p, "Expect variable name");
 
     if (match(p, TOKEN_EQUAL)) {
         expression(vm, p);
@@ -540,39 +818,49 @@ static void forStatement(VM* vm, Parser* p) {
         expressionStatement(vm, p);
     }
 
-    consume(p, TOKEN_SEMICOLON, "Expect ';'.");
-
-    int loopStart = currentChunk()->count;
+    int loopStart = markJumpTarget();
     int exitJump = -1;
     if (!match(p, TOKEN_SEMICOLON)) {
         expression(vm, p);
         consume(p, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        exitJump = emitJump(p, OP_JUMP_IF_FALSE);
-        emitByte(p, OP_POP); // Condition.
+        exitJump = emitConditionJump(p);
     }
-    
+
+    // The increment is compiled here but moved after the body, so each iteration runs straight through
+    // condition, body and increment instead of jumping over the increment and back.
+    int incrementLength = 0;
+    uint8_t* incrementCode = NULL;
+    int* incrementLines = NULL;
     if (!match(p, TOKEN_RIGHT_PAREN)) {
-        int bodyJump = emitJump(p, OP_JUMP);
         int incrementStart = currentChunk()->count;
         expression(vm, p);
-        emitByte(p, OP_POP);
+        emitStatementPop(p);
         consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
-        emitLoop(p, loopStart);
-        loopStart = incrementStart;
-        patchJump(p, bodyJump);
+        incrementLength = currentChunk()->count - incrementStart;
+        incrementCode = GROW_ARRAY(uint8_t, NULL, 0, incrementLength);
+        incrementLines = GROW_ARRAY(int, NULL, 0, incrementLength);
+        memcpy(incrementCode, currentChunk()->code + incrementStart, incrementLength);
+        memcpy(incrementLines, currentChunk()->lines + incrementStart, incrementLength * sizeof(int));
+        currentChunk()->count = incrementStart;
+        markJumpTarget(); // Forget the instructions that were just moved out.
     }
 
-
     statement(vm, p);
-    emitLoop(p, loopStart);
-    if (exitJump != -1) {
-        patchJump(p, exitJump);
-        emitByte(p, OP_POP); // Condition.
+
+    if (incrementCode != NULL) {
+        for (int i = 0; i < incrementLength; i++) {
+            writeChunk(currentChunk(), incrementCode[i], incrementLines[i]);
+        }
+        FREE_ARRAY(uint8_t, incrementCode, incrementLength);
+        FREE_ARRAY(int, incrementLines, incrementLength);
+        markJumpTarget(); // The copied instructions aren't tracked for fusion.
     }
 
+    emitLoop(p, loopStart);
+    if (exitJump != -1) patchJump(p, exitJump);
 
     endScope(p);
 }
@@ -612,18 +900,30 @@ ObjFunction* compile(VM* vm, const char* source) {
     s = initScanner(source);
     Parser* p = initParser();
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(vm, &compiler, TYPE_SCRIPT);
     compilingChunk = &compiler.function->chunk;
 
     advance(p);
     while (!match(p, TOKEN_EOF)) {
         declaration(vm, p);
+        // Between declarations everything the compiler still needs is in the function's constants. Those
+        // are written without a barrier, so the function is remembered right before collecting instead.
+        if (SHOULD_COLLECT(vm)) {
+            REMEMBER(vm, c->function);
+            collectGarbage(vm);
+#ifdef NURSERY
+            // Constants that survived the nursery have moved, and the index is keyed by their address.
+            if (c->constantIndexCapacity > 0) rebuildConstantIndex(c->constantIndexCapacity);
+#endif
+        }
     }
 
     consume(p, TOKEN_EOF, "Expect end of expression.");
 
     bool compiled = !p->hadError;
-    ObjFunction* function = endCompiler(p);
+    ObjFunction* function = endCompiler(vm, p);
+    REMEMBER(vm, function);
+    c = NULL;
 
     free(p);
     free(s);
@@ -631,5 +931,6 @@ ObjFunction* compile(VM* vm, const char* source) {
     return (compiled) ? function : NULL;
 }
 
-
-
+void markCompilerRoots(VM* vm) {
+    if (c != NULL) markObject(vm, (Obj*)c->function);
+}
@@ -49,6 +49,11 @@ typedef enum {
     TYPE_SCRIPT
 } FunctionType;
 
+typedef struct {
+    Value value;
+    int index; // -1 for an unused entry.
+} ConstantEntry;
+
 typedef struct Compiler {
     ObjFunction* function;
     FunctionType type;
@@ -56,9 +61,22 @@ typedef struct Compiler {
     Local locals[UINT8_COUNT];
     int localCount;
     int scopeDepth;
+
+    // Offsets of the last emitted instructions, newest first. Cleared at every jump target, since
+    // instructions on both sides of a target can't be fused into a superinstruction.
+    int recentInstructions[4];
+
+    // Open addressing index from value to position in the chunk's constant pool, so every constant is
+    // stored once, and how many instructions use each constant. Only needed while compiling.
+    ConstantEntry* constantIndex;
+    int constantIndexCount;
+    int constantIndexCapacity;
+    int* constantUses;
+    int constantUsesCapacity;
 } Compiler;
 
 ObjFunction* compile(VM*, const char* source);
+void markCompilerRoots(VM* vm);
 
 static void parsePrecedence(VM*, Parser*, Precedence);
 static void expression(VM*, Parser*);
@@ -23,6 +23,23 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+static uint32_t readLongOperand(Chunk* chunk, int offset) {
+    return (uint32_t)((chunk->code[offset + 1] << 16) | (chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+}
+
+static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
+    uint32_t index = readLongOperand(chunk, offset);
+    printf("%-16s %4d '", name, index);
+    printValue(chunk->constants.values[index]);
+    printf("'\n");
+    return offset + 4;
+}
+
+static int longInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d\n", name, readLongOperand(chunk, offset));
+    return offset + 4;
+}
+
 static int simpleInstruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
@@ -34,6 +51,15 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+static int localConstantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t index = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, index);
+    printValue(chunk->constants.values[index]);
+    printf("'\n");
+    return offset + 3;
+}
+
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
     uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
     jump |= chunk->code[offset + 2];
@@ -68,14 +94,22 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_RETURN:        return simpleInstruction("OP_RETURN", offset);
         case OP_PRINT:         return simpleInstruction("OP_PRINT", offset);
         case OP_POP:           return simpleInstruction("OP_POP", offset);
-        case OP_DEFINE_GLOBAL: return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-        case OP_GET_GLOBAL:    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-        case OP_SET_GLOBAL:    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_DEFINE_GLOBAL: return byteInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL:    return byteInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:    return byteInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_LOCAL:     return byteInstruction("OP_GET_LOCAL", chunk, offset);
         case OP_SET_LOCAL:     return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_JUMP_IF_FALSE: return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_JUMP:          return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_LOOP:          return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_CONSTANT_LONG:      return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+        case OP_DEFINE_GLOBAL_LONG: return longInstruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
+        case OP_GET_GLOBAL_LONG:    return longInstruction("OP_GET_GLOBAL_LONG", chunk, offset);
+        case OP_SET_GLOBAL_LONG:    return longInstruction("OP_SET_GLOBAL_LONG", chunk, offset);
+        case OP_NOT_EQUAL:          return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OP_POP_JUMP_IF_FALSE:  return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESSER: return jumpInstruction("OP_JUMP_IF_NOT_LESSER", 1, chunk, offset);
+        case OP_ADD_LOCAL_CONSTANT: return localConstantInstruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -2,43 +2,563 @@
 // Created by gonzalo on 3/11/21.
 //
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#include "arena.h"
+#include "compiler.h"
 #include "memory.h"
+#include "table.h"
+
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+
+// The VM whose heap every allocation is charged to. Set by initVM and again by interpret, so several VMs
+// can take turns as long as only one of them runs at a time. freeVM switches to the VM it frees and back.
+static VM* allocatingVM = NULL;
+
+// Returns the VM that was allocating before.
+VM* setAllocatingVM(VM* vm) {
+    VM* previous = allocatingVM;
+    allocatingVM = vm;
+    if (vm != NULL && vm->nextGC == 0) vm->nextGC = GC_INITIAL_THRESHOLD;
+    return previous;
+}
+
+// Only counts the bytes, collecting here could free the temporaries of whoever is allocating. The VM and
+// the compiler check SHOULD_COLLECT at points where everything they still need is reachable.
+static void account(size_t oldSize, size_t newSize) {
+    VM* vm = allocatingVM;
+    if (vm == NULL) return;
+
+    if (newSize > oldSize) vm->memStats.allocated += newSize - oldSize;
+    else vm->memStats.freed += oldSize - newSize;
+    vm->bytesAllocated += newSize - oldSize;
+    if (vm->bytesAllocated > vm->memStats.peak) vm->memStats.peak = vm->bytesAllocated;
+}
+
+// Nothing can be done without memory, but the user should at least know why the script stopped.
+static void outOfMemory(size_t size) {
+    fprintf(stderr, "Out of memory allocating %zu bytes.\n", size);
+    exit(71);
+}
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    account(oldSize, newSize);
+#ifdef POOL_ALLOCATOR
+    // Blocks allocated while there was no VM came from the system and are given back to it.
+    if (allocatingVM != NULL) {
+        void* res = poolReallocate(&allocatingVM->pool, pointer, oldSize, newSize);
+        if (res == NULL && newSize != 0) outOfMemory(newSize);
+        return res;
+    }
+#endif
     if (newSize == 0) {
         free(pointer);
         return NULL;
     }
 
     void* res = realloc(pointer, newSize);
-    if (res == NULL) exit(0);
+    if (res == NULL) outOfMemory(newSize);
 
     return res;
 }
 
-static void freeObject(Obj* object) {
+// Big blocks come straight from fresh pages, so the zeroing is paid for page by page as they are first
+// touched instead of all at once here.
+void* allocateZeroed(size_t size) {
+    account(0, size);
+#ifdef POOL_ALLOCATOR
+    if (allocatingVM != NULL && size <= POOL_MAX_SIZE) {
+        void* res = poolAllocate(&allocatingVM->pool, size);
+        if (res == NULL) outOfMemory(size);
+        return memset(res, 0, size);
+    }
+#endif
+    void* res = calloc(1, size);
+    if (res == NULL) outOfMemory(size);
+
+    return res;
+}
+
+// Always from the system, the pool has no alignment beyond 8 bytes. Only size is charged to the VM.
+void* allocateAligned(size_t alignment, size_t size) {
+    account(0, size);
+    void* res;
+    if (posix_memalign(&res, alignment, size) != 0) outOfMemory(size);
+    return res;
+}
+
+void freeAligned(void* pointer, size_t size) {
+    account(size, 0);
+    free(pointer);
+}
+
+static size_t objectSize(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:   return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_ROPE:     return sizeof(ObjRope);
+    }
+    return 0;
+}
+
+static void freeObject(VM* vm, Obj* object) {
+    ObjTypeStats* stats = &vm->memStats.objects[object->type];
+    stats->count--;
+    stats->bytes -= objectSize(object);
+
     switch (object->type) {
         case OBJ_STRING: {
-            free(object);
+            size_t size = objectSize(object);
+#ifdef STRING_ARENA
+            if (size <= ARENA_MAX_SIZE) {
+                arenaRelease(&vm->stringArena, object);
+                break;
+            }
+#endif
+            reallocate(object, size, 0);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-            if (function->name != NULL) free(function->name);
-            free(function);
+            reallocate(function, sizeof(ObjFunction), 0);
+            break;
+        }
+        case OBJ_ROPE: {
+            reallocate(object, sizeof(ObjRope), 0);
+            break;
+        }
+    }
+}
+
+static void freeList(VM* vm, Obj* object) {
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(vm, object);
+        object = next;
+    }
+}
+
+void freeObjects(VM* vm) {
+    freeList(vm, vm->objects);
+    vm->objects = NULL;
+    // What a sweep in progress hasn't reached yet is no longer in vm->objects.
+    freeList(vm, vm->sweepCursor);
+    vm->sweepCursor = NULL;
+
+    free(vm->grayStack);
+    vm->grayStack = NULL;
+    vm->grayCapacity = 0;
+}
+
+// Work lists of objects come from the system allocator, so growing them doesn't count toward a collection.
+void pushObject(Obj*** objects, int* count, int* capacity, Obj* object) {
+    if (*count == *capacity) {
+        *capacity = GROW_CAPACITY(*capacity);
+        *objects = (Obj**)realloc(*objects, sizeof(Obj*) * *capacity);
+        if (*objects == NULL) outOfMemory(sizeof(Obj*) * *capacity);
+    }
+    (*objects)[(*count)++] = object;
+}
+
+void markObject(VM* vm, Obj* object) {
+    if (object == NULL || object->isMarked) return;
+    object->isMarked = true;
+    pushObject(&vm->grayStack, &vm->grayCount, &vm->grayCapacity, object);
+}
+
+void markValue(VM* vm, Value value) {
+    if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+}
+
+static void markArray(VM* vm, ValueArray* array) {
+    for (int i = 0; i < array->count; i++) markValue(vm, array->values[i]);
+}
+
+static void blackenObject(VM* vm, Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING: {
+            // Its characters are only compared through the canonical string, which has to outlive it.
+            markObject(vm, (Obj*)((ObjString*)object)->canonical);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            markObject(vm, (Obj*)function->name);
+            markArray(vm, &function->chunk.constants);
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            markObject(vm, rope->left);
+            markObject(vm, rope->right);
+            markObject(vm, (Obj*)rope->flat);
+            break;
+        }
+    }
+}
+
+static void markRoots(VM* vm) {
+    for (Value* slot = vm->stack.values; slot < vm->stack.top; slot++) markValue(vm, *slot);
+    for (int i = 0; i < vm->frameCount; i++) markObject(vm, (Obj*)vm->frames[i].function);
+
+    markTable(vm, &vm->globals);
+    markArray(vm, &vm->globalNames);
+    markArray(vm, &vm->globalValues);
+    markCompilerRoots(vm);
+}
+
+// The list being swept has been detached from vm->objects, survivors are put back there.
+static void sweepObject(VM* vm, Obj* object) {
+    if (object->isMarked) {
+        object->isMarked = false;
+        object->next = vm->objects;
+        vm->objects = object;
+        return;
+    }
+
+    freeObject(vm, object);
+}
+
+#if defined(NURSERY) || defined(INCREMENTAL_GC)
+
+void writeBarrier(VM* vm, Obj* owner, Obj* child) {
+    if (child == NULL) return;
+#ifdef NURSERY
+    if (isYoung(&vm->nursery, child)) {
+        nurseryRemember(&vm->nursery, owner);
+        return;
+    }
+#endif
+#ifdef INCREMENTAL_GC
+    // While marking, a black object must never point at a white one.
+    if (vm->gcPhase == GC_MARK && owner->isMarked) markObject(vm, child);
+#endif
+}
+
+void rememberObject(VM* vm, Obj* object) {
+#ifdef NURSERY
+    nurseryRemember(&vm->nursery, object);
+#endif
+#ifdef INCREMENTAL_GC
+    // Its fields changed behind the barrier's back, so if it was already scanned it is scanned again.
+    if (vm->gcPhase == GC_MARK && object->isMarked) {
+        pushObject(&vm->grayStack, &vm->grayCount, &vm->grayCapacity, object);
+    }
+#endif
+}
+
+#endif
+
+#ifdef NURSERY
+
+// Copies a young object into the old generation the first time it is reached and leaves the forwarding
+// pointer behind. The copy is a survivor until the objects it points to have been evacuated too. While
+// the old generation is being marked the copy starts out gray, nothing old has been able to mark it.
+Obj* evacuateObject(VM* vm, Obj* object) {
+    if (object == NULL || !isYoung(&vm->nursery, object)) return object;
+    if (object->next != NULL) return object->next;
+
+    size_t size = objectSize(object);
+    Obj* copy = allocateObj(vm, object->type, size);
+    memcpy((char*)copy + sizeof(Obj), (char*)object + sizeof(Obj), size - sizeof(Obj));
+    object->next = copy;
+
+    Nursery* nursery = &vm->nursery;
+    pushObject(&nursery->survivors, &nursery->survivorCount, &nursery->survivorCapacity, copy);
+#ifdef INCREMENTAL_GC
+    if (vm->gcPhase == GC_MARK) markObject(vm, copy);
+#endif
+    return copy;
+}
+
+Value evacuateValue(VM* vm, Value value) {
+    return IS_OBJ(value) ? OBJ_VAL(evacuateObject(vm, AS_OBJ(value))) : value;
+}
+
+static void evacuateArray(VM* vm, ValueArray* array) {
+    for (int i = 0; i < array->count; i++) array->values[i] = evacuateValue(vm, array->values[i]);
+}
+
+// Points every reference held by an old object, or by a copy that was just evacuated, at the old generation.
+static void evacuateReferences(VM* vm, Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            string->canonical = (ObjString*)evacuateObject(vm, (Obj*)string->canonical);
             break;
         }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            function->name = (ObjString*)evacuateObject(vm, (Obj*)function->name);
+            evacuateArray(vm, &function->chunk.constants);
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            rope->left = evacuateObject(vm, rope->left);
+            rope->right = evacuateObject(vm, rope->right);
+            rope->flat = (ObjString*)evacuateObject(vm, (Obj*)rope->flat);
+            break;
+        }
+    }
+}
+
+// A minor collection. It only touches the roots, the remembered objects and the survivors, so it costs
+// nothing for the garbage it leaves behind in the nursery.
+static void collectNursery(VM* vm) {
+    Nursery* nursery = &vm->nursery;
+
+    for (Value* slot = vm->stack.values; slot < vm->stack.top; slot++) *slot = evacuateValue(vm, *slot);
+    evacuateTable(vm, &vm->globals);
+    evacuateArray(vm, &vm->globalNames);
+    evacuateArray(vm, &vm->globalValues);
+    for (int i = 0; i < nursery->rememberedCount; i++) evacuateReferences(vm, nursery->remembered[i]);
+    nursery->rememberedCount = 0;
+
+    while (nursery->survivorCount > 0) evacuateReferences(vm, nursery->survivors[--nursery->survivorCount]);
+
+    tableSweepNursery(&vm->strings, nursery->internedKeys, nursery->internedCount);
+    nursery->internedCount = 0;
+    // Whatever survived has been counted again as it was copied out.
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        vm->memStats.objects[type].count -= vm->memStats.young[type].count;
+        vm->memStats.objects[type].bytes -= vm->memStats.young[type].bytes;
+    }
+    memset(vm->memStats.young, 0, sizeof(vm->memStats.young));
+#ifdef GC_STRESS
+    // Anything still pointing into the nursery now reads garbage instead of an object that looks fine.
+    memset(nursery->start, 0xdd, nursery->top - nursery->start);
+#endif
+    nursery->top = nursery->start;
+}
+
+#endif
+
+static uint64_t nanoTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef GC_STRESS
+#define HEAP_COLLECTION_DUE(vm) true
+#else
+#define HEAP_COLLECTION_DUE(vm) ((vm)->bytesAllocated > (vm)->nextGC)
+#endif
+
+// Runs once marking is done. vm->strings doesn't keep strings alive, interning one that is about to be
+// freed would leave a dangling key behind.
+static void removeWhiteStrings(VM* vm) {
+    tableRemoveWhite(&vm->strings);
+}
+
+static void finishCycle(VM* vm) {
+    vm->gcStats.cycles++;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (vm->nextGC < GC_INITIAL_THRESHOLD) vm->nextGC = GC_INITIAL_THRESHOLD;
+}
+
+#ifdef INCREMENTAL_GC
+
+// Allocated between two slices of the same cycle, per millisecond of budget. A smaller budget gets more
+// frequent slices, so the collector still keeps up with the program.
+#define GC_SLICE_BYTES_PER_MS (256 * 1024)
+#define GC_CLOCK_INTERVAL 64        // Objects traced or swept between two looks at the clock.
+
+// GC_STRESS cuts slices to a handful of objects, so the program runs between as many of them as possible.
+static bool sliceOver(uint64_t deadline, int work) {
+#ifdef GC_STRESS
+    (void)deadline;
+    return work >= 4;
+#else
+    return work % GC_CLOCK_INTERVAL == GC_CLOCK_INTERVAL - 1 && nanoTime() >= deadline;
+#endif
+}
+
+// Done once nothing is gray right after the roots were scanned again. The roots are written without a
+// barrier, that final scan is what catches what the program stored in them since the cycle started.
+static bool markSlice(VM* vm, uint64_t deadline, int* work) {
+    for (;;) {
+        while (vm->grayCount > 0) {
+            if (sliceOver(deadline, (*work)++)) return false;
+            blackenObject(vm, vm->grayStack[--vm->grayCount]);
+        }
+
+        markRoots(vm);
+        if (vm->grayCount == 0) return true;
     }
 }
 
-void freeObjects(Obj* object) {
+// The objects to sweep were detached from vm->objects when the sweep started, so objects created since
+// then aren't looked at and every object swept is one step of bounded work.
+static bool sweepSlice(VM* vm, uint64_t deadline, int* work) {
+    while (vm->sweepCursor != NULL) {
+        if (sliceOver(deadline, (*work)++)) return false;
+        Obj* object = vm->sweepCursor;
+        vm->sweepCursor = object->next;
+        sweepObject(vm, object);
+    }
+    return true;
+}
+
+static void collectSlice(VM* vm, uint64_t deadline) {
+    if (vm->gcPhase == GC_IDLE) {
+        if (!HEAP_COLLECTION_DUE(vm)) return;
+        markRoots(vm);
+        vm->gcPhase = GC_MARK;
+    }
+
+    int work = 0;
+    if (vm->gcPhase == GC_MARK && markSlice(vm, deadline, &work)) {
+        removeWhiteStrings(vm);
+        vm->gcPhase = GC_SWEEP;
+        vm->sweepCursor = vm->objects;
+        vm->objects = NULL;
+    }
+
+    if (vm->gcPhase == GC_SWEEP && sweepSlice(vm, deadline, &work)) {
+        vm->gcPhase = GC_IDLE;
+        finishCycle(vm);
+        return;
+    }
+
+    vm->nextGC = vm->bytesAllocated + (size_t)GC_SLICE_BYTES_PER_MS * vm->gcPauseBudget / 1000;
+}
+
+#else
+
+static void collectHeap(VM* vm) {
+    markRoots(vm);
+    while (vm->grayCount > 0) blackenObject(vm, vm->grayStack[--vm->grayCount]);
+    removeWhiteStrings(vm);
+
+    Obj* object = vm->objects;
+    vm->objects = NULL;
     while (object != NULL) {
         Obj* next = object->next;
-        freeObject(object);
+        sweepObject(vm, object);
         object = next;
     }
+    finishCycle(vm);
+}
+
+#endif
+
+static void recordPause(VM* vm, uint64_t nanos) {
+    GCStats* stats = &vm->gcStats;
+    stats->pauses++;
+    stats->totalNanos += nanos;
+    if (nanos > stats->maxNanos) stats->maxNanos = nanos;
+
+    uint64_t micros = nanos / 1000;
+    int bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && ((uint64_t)2 << bucket) <= micros) bucket++;
+    stats->pauseHistogram[bucket]++;
 }
 
+#if defined(NURSERY) && defined(INCREMENTAL_GC)
+// What a minor collection copies per microsecond when everything in the nursery survives, about half the
+// measured rate so the slice after it still gets some of the budget.
+#define GC_NURSERY_BYTES_PER_US 256
+#endif
+
+// With NURSERY the budget also decides how full the nursery gets before a minor collection, one that
+// copies out all of it has to fit too. Scanning the stack and the globals isn't bounded by it.
+void setGCPauseBudget(VM* vm, int micros) {
+    vm->gcPauseBudget = micros;
+#if defined(NURSERY) && defined(INCREMENTAL_GC)
+    size_t fill = (size_t)micros * GC_NURSERY_BYTES_PER_US;
+    if (fill < NURSERY_MAX_OBJECT) fill = NURSERY_MAX_OBJECT;
+    if (fill > NURSERY_SIZE - NURSERY_SIZE / 8) fill = NURSERY_SIZE - NURSERY_SIZE / 8;
+    vm->nursery.limit = vm->nursery.start + fill;
+#endif
+}
+
+// Always collects the nursery first, so the old generation is only ever marked and swept while the
+// nursery is empty. The whole heap is collected once it has grown past nextGC, or with INCREMENTAL_GC a
+// slice of at most vm->gcPauseBudget microseconds of it.
+void collectGarbage(VM* vm) {
+    uint64_t start = nanoTime();
+#ifdef NURSERY
+    collectNursery(vm);
+#endif
+#ifdef INCREMENTAL_GC
+    collectSlice(vm, start + (uint64_t)vm->gcPauseBudget * 1000);
+#else
+    if (HEAP_COLLECTION_DUE(vm)) collectHeap(vm);
+#endif
+    recordPause(vm, nanoTime() - start);
+}
+
+// Pauses are only known to the power of two microseconds, percentiles are the upper end of their bucket.
+static uint64_t pausePercentile(GCStats* stats, double fraction) {
+    uint64_t seen = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        seen += stats->pauseHistogram[i];
+        if (seen >= fraction * stats->pauses) return (uint64_t)2 << i;
+    }
+    return (uint64_t)2 << (GC_PAUSE_BUCKETS - 1);
+}
+
+void printGCStats(VM* vm) {
+    GCStats* stats = &vm->gcStats;
+    fprintf(stderr, "gc: %llu pauses, %llu heap cycles, %.3f ms paused in total, longest %.1f us\n",
+            (unsigned long long)stats->pauses, (unsigned long long)stats->cycles, stats->totalNanos / 1e6,
+            stats->maxNanos / 1e3);
+    if (stats->pauses == 0) return;
+
+    fprintf(stderr, "  p50 < %llu us, p99 < %llu us, p99.9 < %llu us\n",
+            (unsigned long long)pausePercentile(stats, 0.5), (unsigned long long)pausePercentile(stats, 0.99),
+            (unsigned long long)pausePercentile(stats, 0.999));
+    fprintf(stderr, "  pause histogram (us):\n");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (stats->pauseHistogram[i] == 0) continue;
+
+        int low = i == 0 ? 0 : 1 << i;
+        fprintf(stderr, "    %7d-%-7d %llu\n", low, (2 << i) - 1, (unsigned long long)stats->pauseHistogram[i]);
+    }
+}
+
+static void measureFunctions(Obj* object, MemUsage* usage) {
+    for (; object != NULL; object = object->next) {
+        if (object->type != OBJ_FUNCTION) continue;
+
+        Chunk* chunk = &((ObjFunction*)object)->chunk;
+        usage->code += sizeof(uint8_t) * chunk->capacity;
+        usage->lines += sizeof(int) * chunk->capacity;
+        usage->constants += sizeof(Value) * chunk->constants.capacity;
+    }
+}
+
+void measureMemory(VM* vm, MemUsage* usage) {
+    memset(usage, 0, sizeof(MemUsage));
+    // Functions are never young, they are either in the objects list or in what a sweep in progress
+    // hasn't reached yet.
+    measureFunctions(vm->objects, usage);
+    measureFunctions(vm->sweepCursor, usage);
+    usage->tables = tableBytes(&vm->strings) + tableBytes(&vm->globals);
+    usage->globals = sizeof(Value) * (vm->globalNames.capacity + vm->globalValues.capacity);
+}
+
+void printMemStats(VM* vm) {
+    static const char* typeNames[OBJ_TYPE_COUNT] = {"string", "function", "rope"};
+    MemStats* stats = &vm->memStats;
+    fprintf(stderr, "memory: %.1f KiB live, peak %.1f KiB, %.1f KiB allocated and %.1f KiB freed in total\n",
+            vm->bytesAllocated / 1024.0, stats->peak / 1024.0, stats->allocated / 1024.0, stats->freed / 1024.0);
+
+    fprintf(stderr, "  objects:\n");
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        fprintf(stderr, "    %-9s %10llu %12llu bytes\n", typeNames[type],
+                (unsigned long long)stats->objects[type].count, (unsigned long long)stats->objects[type].bytes);
+    }
+
+    MemUsage usage;
+    measureMemory(vm, &usage);
+    fprintf(stderr, "  chunk code %zu, line tables %zu, constants %zu, hash tables %zu, global slots %zu bytes\n",
+            usage.code, usage.lines, usage.constants, usage.tables, usage.globals);
+}
@@ -17,7 +17,60 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+#define ALLOCATE_ZEROED(type, count) \
+    (type*)allocateZeroed(sizeof(type) * (count))
+
+// A collection is due once the heap has grown past vm->nextGC, or with NURSERY once the nursery is almost
+// full. GC_STRESS makes every check collect.
+#ifdef GC_STRESS
+#define SHOULD_COLLECT(vm) true
+#elif defined(NURSERY)
+#define SHOULD_COLLECT(vm) ((vm)->nursery.top > (vm)->nursery.limit || (vm)->bytesAllocated > (vm)->nextGC)
+#else
+#define SHOULD_COLLECT(vm) ((vm)->bytesAllocated > (vm)->nextGC)
+#endif
+
+// Every store of an object into an object that was created before it has to go through WRITE_BARRIER,
+// or REMEMBER the owner once done storing. That is how minor collections find the young objects an old
+// object points to, and how incremental marking finds what was stored into an object it already scanned.
+#if defined(NURSERY) || defined(INCREMENTAL_GC)
+#define REMEMBER(vm, object) rememberObject(vm, (Obj*)(object))
+#define WRITE_BARRIER(vm, owner, child) writeBarrier(vm, (Obj*)(owner), (Obj*)(child))
+void rememberObject(VM* vm, Obj* object);
+void writeBarrier(VM* vm, Obj* owner, Obj* child);
+#else
+#define REMEMBER(vm, object) ((void)0)
+#define WRITE_BARRIER(vm, owner, child) ((void)0)
+#endif
+
+VM* setAllocatingVM(VM* vm);
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
-void freeObjects(Obj* objects);
+void* allocateZeroed(size_t size);
+void* allocateAligned(size_t alignment, size_t size);
+void freeAligned(void* pointer, size_t size);
+void freeObjects(VM* vm);
+
+void pushObject(Obj*** objects, int* count, int* capacity, Obj* object);
+void markObject(VM* vm, Obj* object);
+void markValue(VM* vm, Value value);
+#ifdef NURSERY
+Obj* evacuateObject(VM* vm, Obj* object);
+Value evacuateValue(VM* vm, Value value);
+#endif
+void collectGarbage(VM* vm);
+void setGCPauseBudget(VM* vm, int micros);
+void printGCStats(VM* vm); // To stderr.
+
+// Where the live bytes of the VM's heap go besides objects, added up by walking it when asked for.
+typedef struct {
+    size_t code;      // Bytecode of every function.
+    size_t lines;     // The line of each instruction, kept for runtime errors.
+    size_t constants; // Constant tables of every function.
+    size_t tables;    // The interned strings and the globals table.
+    size_t globals;   // Names and values of the global slots.
+} MemUsage;
+
+void measureMemory(VM* vm, MemUsage* usage);
+void printMemStats(VM* vm); // To stderr.
 
 #endif
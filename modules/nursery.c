@@ -0,0 +1,48 @@
+//
+// Bump-pointer young generation for short lived objects, used for ObjString and ObjRope.
+//
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "nursery.h"
+
+void initNursery(Nursery* nursery) {
+    nursery->start = (char*)reallocate(NULL, 0, NURSERY_SIZE);
+    nursery->top = nursery->start;
+    nursery->limit = nursery->start + NURSERY_SIZE - NURSERY_SIZE / 8;
+    nursery->end = nursery->start + NURSERY_SIZE;
+    nursery->remembered = NULL;
+    nursery->rememberedCount = 0;
+    nursery->rememberedCapacity = 0;
+    nursery->survivors = NULL;
+    nursery->survivorCount = 0;
+    nursery->survivorCapacity = 0;
+    nursery->internedKeys = NULL;
+    nursery->internedCount = 0;
+    nursery->internedCapacity = 0;
+}
+
+void freeNursery(Nursery* nursery) {
+    reallocate(nursery->start, NURSERY_SIZE, 0);
+    free(nursery->remembered);
+    free(nursery->survivors);
+    free(nursery->internedKeys);
+    nursery->start = nursery->top = nursery->limit = nursery->end = NULL;
+    nursery->remembered = NULL;
+    nursery->rememberedCount = 0;
+    nursery->rememberedCapacity = 0;
+    nursery->survivors = NULL;
+    nursery->survivorCount = 0;
+    nursery->survivorCapacity = 0;
+    nursery->internedKeys = NULL;
+    nursery->internedCount = 0;
+    nursery->internedCapacity = 0;
+}
+
+// The fields behind the write barrier are only ever set once, so an object is remembered at most a few
+// times between collections and duplicates aren't worth filtering out.
+void nurseryRemember(Nursery* nursery, Obj* object) {
+    if (isYoung(nursery, object)) return;
+    pushObject(&nursery->remembered, &nursery->rememberedCount, &nursery->rememberedCapacity, object);
+}
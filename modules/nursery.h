@@ -0,0 +1,57 @@
+//
+// Bump-pointer young generation for short lived objects, used for ObjString and ObjRope.
+//
+
+#ifndef CLOX_NURSERY_H
+#define CLOX_NURSERY_H
+
+#include "common.h"
+#include "value.h"
+
+#define NURSERY_SIZE (512 * 1024)
+#define NURSERY_MAX_OBJECT 1024 // Bigger objects are allocated old, copying them out isn't worth it.
+
+// Young objects aren't linked into vm->objects. A minor collection copies the ones still reachable into
+// the old generation and starts over from the beginning of the block. Until then a young object's next
+// field is its forwarding pointer: NULL, or where it was copied to.
+typedef struct {
+    char* start;
+    char* top;
+    char* limit; // A collection is asked for once top passes this, before allocations start to fail.
+    char* end;
+
+    // Old objects that may point into the nursery. They are scanned as roots by the next minor collection.
+    Obj** remembered;
+    int rememberedCount;
+    int rememberedCapacity;
+
+    // Copies made by the minor collection in progress whose fields may still point into the nursery.
+    Obj** survivors;
+    int survivorCount;
+    int survivorCapacity;
+
+    // Young strings interned in vm->strings since the last minor collection, the only entries it updates.
+    Obj** internedKeys;
+    int internedCount;
+    int internedCapacity;
+} Nursery;
+
+void initNursery(Nursery* nursery);
+void freeNursery(Nursery* nursery);
+void nurseryRemember(Nursery* nursery, Obj* object);
+
+static inline bool isYoung(Nursery* nursery, Obj* object) {
+    return (char*)object >= nursery->start && (char*)object < nursery->end;
+}
+
+// NULL when there is no room left, the caller falls back to allocating old.
+static inline Obj* nurseryAllocate(Nursery* nursery, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (size > NURSERY_MAX_OBJECT || nursery->top + size > nursery->end) return NULL;
+
+    Obj* object = (Obj*)nursery->top;
+    nursery->top += size;
+    return object;
+}
+
+#endif //CLOX_NURSERY_H
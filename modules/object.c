@@ -11,19 +11,63 @@
 #include "value.h"
 #include "table.h"
 
-Obj* allocateObj(Obj* prev, ObjType type, size_t size) {
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
-    obj->type = type;
-    if (prev != NULL) {
-        obj->next = prev;
-        prev = obj;
+static inline void countObject(ObjTypeStats* stats, size_t size) {
+    stats->count++;
+    stats->bytes += size;
+}
+
+Obj* allocateObj(VM* vm, ObjType type, size_t size) {
+#ifdef STRING_ARENA
+    if (type == OBJ_STRING && size <= ARENA_MAX_SIZE) {
+        return initObj(vm, (Obj*)arenaAllocate(&vm->stringArena, size), type, size);
     }
+#endif
+    return initObj(vm, (Obj*)reallocate(NULL, 0, size), type, size);
+}
+
+// For objects that are likely to die young. Whoever stores the result into an older object has to go
+// through WRITE_BARRIER.
+Obj* allocateYoungObj(VM* vm, ObjType type, size_t size) {
+#ifdef NURSERY
+    Obj* obj = nurseryAllocate(&vm->nursery, size);
+    if (obj != NULL) {
+        countObject(&vm->memStats.objects[type], size);
+        countObject(&vm->memStats.young[type], size);
+        obj->type = type;
+        obj->isMarked = false;
+        obj->next = NULL;
+        return obj;
+    }
+#endif
+    return allocateObj(vm, type, size);
+}
+
+// Sets up the header of an object whose memory didn't come from allocateObj.
+Obj* initObj(VM* vm, Obj* obj, ObjType type, size_t size) {
+    countObject(&vm->memStats.objects[type], size);
+    obj->type = type;
+    obj->isMarked = false;
+    obj->next = vm->objects;
+    vm->objects = obj;
     return obj;
 }
 
+// Only reached when tracing, run() flattens ropes before printing them.
+static void printRope(ObjRope* rope) {
+    if (rope->flat != NULL) {
+        printf("%s", rope->flat->chars);
+        return;
+    }
+
+    Value left = OBJ_VAL(rope->left), right = OBJ_VAL(rope->right);
+    printObject(left);
+    printObject(right);
+}
+
 void printObject(Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+        case OBJ_ROPE: printRope(AS_ROPE(value)); break;
         case OBJ_FUNCTION: {
             ObjFunction* function = AS_FUNCTION(value);
             if (function->name != NULL) printf("<fn %s>", function->name->chars);
@@ -33,8 +77,8 @@ void printObject(Value value) {
     }
 }
 
-ObjFunction *newFunction() {
-    ObjFunction* function = (ObjFunction*)allocateObj(NULL, OBJ_FUNCTION, sizeof(ObjFunction));
+ObjFunction *newFunction(VM* vm) {
+    ObjFunction* function = (ObjFunction*)allocateObj(vm, OBJ_FUNCTION, sizeof(ObjFunction));
     function->arity = 0;
     function->name = NULL;
     initChunk(&function->chunk);
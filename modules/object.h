@@ -13,28 +13,41 @@
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 #define IS_STRING(value)     isObjType(value, OBJ_STRING)
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
+#define IS_ROPE(value)         isObjType(value, OBJ_ROPE)
+#define IS_ANY_STRING(value)   (IS_SHORT_STRING(value) || IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 #define AS_FUNCTION(value)       ((ObjFunction*)AS_OBJ(value))
-
-typedef enum {
-    OBJ_STRING,
-    OBJ_FUNCTION,
-} ObjType;
+#define AS_ROPE(value)         ((ObjRope*)AS_OBJ(value))
 
 struct Obj {
     ObjType type;
-    struct Obj* next;
+    bool isMarked;
+    struct Obj* next; // Every object of a VM is in its objects list, which is what the collector sweeps.
 };
 
 struct ObjString {
     Obj obj;
     int length;
-    uint32_t hash;
+    uint32_t hash;      // Only valid once canonical is set.
+    // The interned string with the same characters, which is this string itself if it is the interned one.
+    // NULL until internString is called on a string created at runtime. Equality and table keys go through
+    // canonical strings only, so they can be compared by pointer.
+    struct ObjString* canonical;
     char chars[];
 };
 
+// The lazy result of concatenating two strings, each either an ObjString or another ObjRope. The characters
+// are only copied out when the string is compared or printed; see flattenRope.
+typedef struct ObjRope {
+    Obj obj;
+    int length;
+    Obj* left;
+    Obj* right;
+    ObjString* flat; // Set by flattenRope, which then drops left and right.
+} ObjRope;
+
 struct ObjFunction {
     Obj obj;
     int arity;
@@ -42,10 +55,12 @@ struct ObjFunction {
     ObjString* name;
 };
 
-Obj* allocateObj(Obj* prev, ObjType type, size_t size);
+Obj* allocateObj(VM* vm, ObjType type, size_t size);
+Obj* allocateYoungObj(VM* vm, ObjType type, size_t size);
+Obj* initObj(VM* vm, Obj* obj, ObjType type, size_t size);
 void printObject(Value value);
 
-ObjFunction* newFunction();
+ObjFunction* newFunction(VM* vm);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,103 @@
+//
+// Size-classed free lists for the small blocks reallocate hands out, carved from slabs.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+// Every multiple of 8 up to 64, where most objects and small arrays fall, then four classes per doubling.
+static const size_t classSizes[POOL_CLASSES] = {
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+// Keeps the blocks after it aligned to 16 bytes, like malloc's.
+#define SLAB_HEADER_SIZE 16
+
+void initPool(Pool* pool) {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        pool->freeLists[i] = NULL;
+        pool->top[i] = NULL;
+        pool->end[i] = NULL;
+    }
+    pool->slabs = NULL;
+
+    int c = 0;
+    for (int i = 0; i <= POOL_MAX_SIZE / 8; i++) {
+        while (classSizes[c] < (size_t)i * 8) c++;
+        pool->classes[i] = (uint8_t)c;
+    }
+}
+
+void freePool(Pool* pool) {
+    void* slab = pool->slabs;
+    while (slab != NULL) {
+        void* next = *(void**)slab;
+        free(slab);
+        slab = next;
+    }
+    initPool(pool);
+}
+
+static inline int sizeClass(Pool* pool, size_t size) {
+    return pool->classes[(size + 7) >> 3];
+}
+
+static bool newSlab(Pool* pool, int c) {
+    char* slab = (char*)malloc(POOL_SLAB_SIZE);
+    if (slab == NULL) return false;
+
+    *(void**)slab = pool->slabs;
+    pool->slabs = slab;
+    pool->top[c] = slab + SLAB_HEADER_SIZE;
+    pool->end[c] = slab + POOL_SLAB_SIZE;
+    return true;
+}
+
+void* poolAllocate(Pool* pool, size_t size) {
+    int c = sizeClass(pool, size);
+    void* block = pool->freeLists[c];
+    if (block != NULL) {
+        pool->freeLists[c] = *(void**)block;
+        return block;
+    }
+
+    size_t blockSize = classSizes[c];
+    if (pool->top[c] == NULL || pool->top[c] + blockSize > pool->end[c]) {
+        if (!newSlab(pool, c)) return NULL;
+    }
+    block = pool->top[c];
+    pool->top[c] += blockSize;
+    return block;
+}
+
+void poolRelease(Pool* pool, void* pointer, size_t size) {
+    int c = sizeClass(pool, size);
+    *(void**)pointer = pool->freeLists[c];
+    pool->freeLists[c] = pointer;
+}
+
+// Same contract as reallocate, except that it returns NULL instead of exiting when out of memory.
+void* poolReallocate(Pool* pool, void* pointer, size_t oldSize, size_t newSize) {
+    bool wasSmall = oldSize <= POOL_MAX_SIZE;
+    bool isSmall = newSize <= POOL_MAX_SIZE;
+
+    if (newSize == 0) {
+        if (pointer == NULL) return NULL;
+        if (wasSmall) poolRelease(pool, pointer, oldSize);
+        else free(pointer);
+        return NULL;
+    }
+    if (pointer == NULL) return isSmall ? poolAllocate(pool, newSize) : malloc(newSize);
+
+    if (wasSmall && isSmall && sizeClass(pool, oldSize) == sizeClass(pool, newSize)) return pointer;
+    if (!wasSmall && !isSmall) return realloc(pointer, newSize);
+
+    void* moved = isSmall ? poolAllocate(pool, newSize) : malloc(newSize);
+    if (moved == NULL) return NULL;
+    memcpy(moved, pointer, oldSize < newSize ? oldSize : newSize);
+    if (wasSmall) poolRelease(pool, pointer, oldSize);
+    else free(pointer);
+    return moved;
+}
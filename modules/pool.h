@@ -0,0 +1,31 @@
+//
+// Size-classed free lists for the small blocks reallocate hands out, carved from slabs.
+//
+
+#ifndef CLOX_POOL_H
+#define CLOX_POOL_H
+
+#include "common.h"
+
+#define POOL_CLASSES 20
+#define POOL_MAX_SIZE 512 // Bigger blocks go to the system allocator.
+#define POOL_SLAB_SIZE (64 * 1024)
+
+// reallocate always knows the size of the block it is given back, so blocks carry no header and the
+// size picks the free list a released block goes on. Every slab holds blocks of a single class, freed
+// blocks are reused by the next allocation of that class and slabs are only returned by freePool.
+typedef struct {
+    void* freeLists[POOL_CLASSES]; // Linked through the first word of each free block.
+    char* top[POOL_CLASSES];       // Next never used block in the class's current slab.
+    char* end[POOL_CLASSES];
+    void* slabs;                   // Every slab, linked through its first word.
+    uint8_t classes[POOL_MAX_SIZE / 8 + 1]; // Size class by size in 8 byte steps, rounded up.
+} Pool;
+
+void initPool(Pool* pool);
+void freePool(Pool* pool);
+void* poolAllocate(Pool* pool, size_t size); // NULL when the system is out of memory.
+void poolRelease(Pool* pool, void* pointer, size_t size);
+void* poolReallocate(Pool* pool, void* pointer, size_t oldSize, size_t newSize);
+
+#endif //CLOX_POOL_H
@@ -0,0 +1,204 @@
+// The body of the interpreter loop. vm.c includes this file once per instance of the loop, with
+// RUN_FUNCTION naming the function and TRACE_INSTRUCTION() deciding what runs before every instruction,
+// so tracing costs nothing in the untraced instance.
+
+static InterpretResult RUN_FUNCTION(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    register uint8_t* ip = frame->ip;
+    register Value* sp = vm->stack.top;
+    register Value* slots = frame->slots;
+    // The compiler is the only one adding global slots, so the array doesn't move while running.
+    Value* globals = vm->globalValues.values;
+#ifdef TOS_CACHING
+    register Value tos;
+    Value popped;
+#endif
+    LOAD_TOP();
+
+#ifdef THREADED_DISPATCH
+    static void* dispatchTable[] = {
+            [OP_CONSTANT]      = &&label_OP_CONSTANT,
+            [OP_NIL]           = &&label_OP_NIL,
+            [OP_TRUE]          = &&label_OP_TRUE,
+            [OP_FALSE]         = &&label_OP_FALSE,
+            [OP_EQUAL]         = &&label_OP_EQUAL,
+            [OP_GREATER]       = &&label_OP_GREATER,
+            [OP_LESSER]        = &&label_OP_LESSER,
+            [OP_ADD]           = &&label_OP_ADD,
+            [OP_SUBTRACT]      = &&label_OP_SUBTRACT,
+            [OP_MULTIPLY]      = &&label_OP_MULTIPLY,
+            [OP_DIVIDE]        = &&label_OP_DIVIDE,
+            [OP_NOT]           = &&label_OP_NOT,
+            [OP_NEGATE]        = &&label_OP_NEGATE,
+            [OP_PRINT]         = &&label_OP_PRINT,
+            [OP_POP]           = &&label_OP_POP,
+            [OP_DEFINE_GLOBAL] = &&label_OP_DEFINE_GLOBAL,
+            [OP_GET_GLOBAL]    = &&label_OP_GET_GLOBAL,
+            [OP_SET_GLOBAL]    = &&label_OP_SET_GLOBAL,
+            [OP_GET_LOCAL]     = &&label_OP_GET_LOCAL,
+            [OP_SET_LOCAL]     = &&label_OP_SET_LOCAL,
+            [OP_JUMP_IF_FALSE] = &&label_OP_JUMP_IF_FALSE,
+            [OP_JUMP]          = &&label_OP_JUMP,
+            [OP_LOOP]          = &&label_OP_LOOP,
+            [OP_RETURN]        = &&label_OP_RETURN,
+            [OP_CONSTANT_LONG]      = &&label_OP_CONSTANT_LONG,
+            [OP_DEFINE_GLOBAL_LONG] = &&label_OP_DEFINE_GLOBAL_LONG,
+            [OP_GET_GLOBAL_LONG]    = &&label_OP_GET_GLOBAL_LONG,
+            [OP_SET_GLOBAL_LONG]    = &&label_OP_SET_GLOBAL_LONG,
+            [OP_NOT_EQUAL]          = &&label_OP_NOT_EQUAL,
+            [OP_POP_JUMP_IF_FALSE]  = &&label_OP_POP_JUMP_IF_FALSE,
+            [OP_JUMP_IF_NOT_LESSER] = &&label_OP_JUMP_IF_NOT_LESSER,
+            [OP_ADD_LOCAL_CONSTANT] = &&label_OP_ADD_LOCAL_CONSTANT,
+    };
+#endif
+
+    uint8_t instruction;
+    for (;;) {
+        TRACE_INSTRUCTION();
+        DISPATCH() {
+            CASE(OP_CONSTANT): {
+                Value constant = READ_CONSTANT();
+                PUSH(constant);
+                NEXT;
+            }
+            CASE(OP_NIL): PUSH(NIL_VAL); NEXT;
+            CASE(OP_TRUE): PUSH(BOOL_VAL(true)); NEXT;
+            CASE(OP_FALSE): PUSH(BOOL_VAL(false)); NEXT;
+            CASE(OP_EQUAL): EQUALITY_OP(==, valuesEqual); NEXT;
+            CASE(OP_GREATER): COMPARISON_OP(>, valuesGreater); NEXT;
+            CASE(OP_LESSER): COMPARISON_OP(<, valuesLesser); NEXT;
+            CASE(OP_ADD): {
+                Value b = TOP;
+                Value a = SECOND;
+                if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                    REPLACE_TOP_TWO(NUMBER_VAL(AS_NUMBER(a)+AS_NUMBER(b)));
+                } else if (IS_ANY_STRING(a) && IS_ANY_STRING(b)) {
+                    REPLACE_TOP_TWO(concatenate(vm, a, b));
+                    GC_SAFEPOINT();
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                NEXT;
+            }
+            CASE(OP_SUBTRACT): NUMBER_OP(NUMBER_VAL, -); NEXT;
+            CASE(OP_MULTIPLY): NUMBER_OP(NUMBER_VAL, *); NEXT;
+            CASE(OP_DIVIDE): NUMBER_OP(NUMBER_VAL, /); NEXT;
+            CASE(OP_NOT): TOP = BOOL_VAL(isFalsey(TOP)); NEXT;
+            CASE(OP_NEGATE): {
+                if (!IS_NUMBER(TOP)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                TOP = NUMBER_VAL(-AS_NUMBER(TOP));
+                NEXT;
+            }
+            CASE(OP_PRINT): {
+                Value value = POP();
+                if (IS_ROPE(value)) value = OBJ_VAL(flattenRope(vm, AS_ROPE(value)));
+                printValue(value);
+                printf("\n");
+                GC_SAFEPOINT();
+                NEXT;
+            }
+            CASE(OP_POP):
+                DROP();
+                NEXT;
+            CASE(OP_DEFINE_GLOBAL): {
+                globals[READ_BYTE()] = POP();
+                NEXT;
+            }
+            CASE(OP_GET_GLOBAL): {
+                uint8_t slot = READ_BYTE();
+                GET_GLOBAL(slot);
+                NEXT;
+            }
+            CASE(OP_SET_GLOBAL): {
+                uint8_t slot = READ_BYTE();
+                SET_GLOBAL(slot);
+                NEXT;
+            }
+            CASE(OP_GET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                SPILL_TOP();
+                PUSH(slots[slot]);
+                NEXT;
+            }
+            CASE(OP_SET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                slots[slot] = TOP;
+                NEXT;
+            }
+            CASE(OP_JUMP_IF_FALSE): {
+                uint16_t offset = READ_16_BYTE();
+                ip += (uint16_t)isFalsey(TOP) * offset;
+                NEXT;
+            }
+            CASE(OP_JUMP): {
+                uint16_t offset = READ_16_BYTE();
+                ip += offset;
+                NEXT;
+            }
+            CASE(OP_LOOP): {
+                uint16_t offset = READ_16_BYTE();
+                ip -= offset;
+                NEXT;
+            }
+            CASE(OP_RETURN): {
+                STORE_FRAME();
+                return INTERPRET_OK;
+            }
+            CASE(OP_CONSTANT_LONG): {
+                Value constant = READ_CONSTANT_LONG();
+                PUSH(constant);
+                NEXT;
+            }
+            CASE(OP_DEFINE_GLOBAL_LONG): {
+                globals[READ_24_BYTE()] = POP();
+                NEXT;
+            }
+            CASE(OP_GET_GLOBAL_LONG): {
+                uint32_t slot = READ_24_BYTE();
+                GET_GLOBAL(slot);
+                NEXT;
+            }
+            CASE(OP_SET_GLOBAL_LONG): {
+                uint32_t slot = READ_24_BYTE();
+                SET_GLOBAL(slot);
+                NEXT;
+            }
+            CASE(OP_NOT_EQUAL): EQUALITY_OP(!=, !valuesEqual); NEXT;
+            CASE(OP_POP_JUMP_IF_FALSE): {
+                uint16_t offset = READ_16_BYTE();
+                ip += (uint16_t)isFalsey(TOP) * offset;
+                DROP();
+                NEXT;
+            }
+            CASE(OP_JUMP_IF_NOT_LESSER): {
+                uint16_t offset = READ_16_BYTE();
+                bool lesser;
+                COMPARE(lesser, <, valuesLesser, false);
+                ip += (uint16_t)!lesser * offset;
+                DROP();
+                DROP();
+                NEXT;
+            }
+            CASE(OP_ADD_LOCAL_CONSTANT): {
+                uint8_t slot = READ_BYTE();
+                Value b = READ_CONSTANT();
+                SPILL_TOP();
+                Value a = slots[slot];
+                if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                    slots[slot] = NUMBER_VAL(AS_NUMBER(a)+AS_NUMBER(b));
+                } else if (IS_ANY_STRING(a) && IS_ANY_STRING(b)) {
+                    slots[slot] = concatenate(vm, a, b);
+                    // The slot may be the cached top, which the safepoint would spill over the result.
+                    RELOAD_TOP();
+                    GC_SAFEPOINT();
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                RELOAD_TOP();
+                NEXT;
+            }
+        }
+    }
+}
@@ -38,7 +38,8 @@ static Token errorToken(Scanner* s, const char* msg) {
     Token token;
     token.type = TOKEN_ERROR;
     token.line = s->line;
-    token.start = s->start;
+    token.start = msg;
+    token.length = (int)strlen(msg);
     return token;
 }
 
@@ -69,6 +70,10 @@ static void skipWhitespace(Scanner* s) {
             case ' ':
             case '\r':
             case '\t': advance(s); break;
+            case '\n':
+                s->line++;
+                advance(s);
+                break;
             case '/': {
                 if (peekNext(s) == '/') {
                     // A comment goes until the end of the line.
@@ -191,10 +196,6 @@ Token scanToken(Scanner *s) {
         case '<': return makeToken(s, match(s, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>': return makeToken(s, match(s, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '"': return string(s);
-        case '\n':
-            s->line++;
-            advance(s);
-            break;
         default: return errorToken(s, "Unexpected character.");
     }
 }
@@ -9,35 +9,179 @@
 #include "object.h"
 #include "strings.h"
 
-ObjString* allocateString(VM* vm, const char* chars, int length, uint32_t hash) {
-    ObjString* str = (ObjString*)allocateObj(vm->objects, OBJ_STRING, sizeof (ObjString)+length+1);
-    memcpy(str->chars, chars, length);
+static ObjString* allocateString(VM* vm, int length) {
+    ObjString* str = (ObjString*)allocateYoungObj(vm, OBJ_STRING, sizeof (ObjString)+length+1);
     str->chars[length] = '\0';
     str->length = length;
+    str->hash = 0;
+    str->canonical = NULL;
+    return str;
+}
+
+static ObjString* intern(VM* vm, ObjString* str, uint32_t hash) {
     str->hash = hash;
+    str->canonical = str;
     tableSet(&vm->strings, str, NIL_VAL);
+#ifdef NURSERY
+    Nursery* nursery = &vm->nursery;
+    if (isYoung(nursery, (Obj*)str)) {
+        pushObject(&nursery->internedKeys, &nursery->internedCount, &nursery->internedCapacity, (Obj*)str);
+    }
+#endif
     return str;
 }
 
-ObjString* copyString(VM* vm, char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+ObjString* copyString(VM* vm, const char* chars, int length) {
+    uint32_t hash = hashString(vm->hashSeed, chars, length);
 
     ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL) {
         return interned;
     }
 
-    return allocateString(vm, chars, length, hash);
+    ObjString* str = allocateString(vm, length);
+    memcpy(str->chars, chars, length);
+    return intern(vm, str, hash);
 }
 
-ObjString* takeString(VM* vm, char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+ObjString* internString(VM* vm, ObjString* str) {
+    if (str->canonical != NULL) return str->canonical;
 
-    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    uint32_t hash = hashString(vm->hashSeed, str->chars, str->length);
+    ObjString* interned = tableFindString(&vm->strings, str->chars, str->length, hash);
     if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
+        str->hash = hash;
+        str->canonical = interned;
+        WRITE_BARRIER(vm, str, interned);
         return interned;
     }
 
-    return allocateString(vm, chars, length, hash);
-}
\ No newline at end of file
+    return intern(vm, str, hash);
+}
+
+Value stringValue(VM* vm, const char* chars, int length) {
+    if (length <= SHORT_STRING_MAX) return shortStringValue(chars, length);
+    return OBJ_VAL(copyString(vm, chars, length));
+}
+
+ObjString* concatenateStrings(VM* vm, ObjString* a, ObjString* b) {
+    ObjString* str = allocateString(vm, a->length + b->length);
+    memcpy(str->chars, a->chars, a->length);
+    memcpy(str->chars + a->length, b->chars, b->length);
+    return str;
+}
+
+// A flattened rope stands for its flat string from then on.
+static Obj* unwrap(Obj* string) {
+    if (string->type == OBJ_ROPE && ((ObjRope*)string)->flat != NULL) return (Obj*)((ObjRope*)string)->flat;
+    return string;
+}
+
+static int stringLength(Value string) {
+    if (IS_SHORT_STRING(string)) {
+        char chars[SHORT_STRING_MAX];
+        return shortStringChars(string, chars);
+    }
+    return IS_ROPE(string) ? AS_ROPE(string)->length : AS_STRING(string)->length;
+}
+
+// Short strings grow into ObjStrings when they become part of a longer one.
+static Obj* toObj(VM* vm, Value string) {
+    if (!IS_SHORT_STRING(string)) return unwrap(AS_OBJ(string));
+
+    char chars[SHORT_STRING_MAX];
+    int length = shortStringChars(string, chars);
+    ObjString* str = allocateString(vm, length);
+    memcpy(str->chars, chars, length);
+    return (Obj*)str;
+}
+
+static const char* flatChars(Value string, char* buffer) {
+    if (IS_SHORT_STRING(string)) {
+        shortStringChars(string, buffer);
+        return buffer;
+    }
+    return AS_STRING(string)->chars;
+}
+
+Value concatenate(VM* vm, Value a, Value b) {
+    if (IS_ROPE(a) && AS_ROPE(a)->flat != NULL) a = OBJ_VAL(AS_ROPE(a)->flat);
+    if (IS_ROPE(b) && AS_ROPE(b)->flat != NULL) b = OBJ_VAL(AS_ROPE(b)->flat);
+
+    int lengthA = stringLength(a);
+    int lengthB = stringLength(b);
+    int length = lengthA + lengthB;
+    if (length < ROPE_MIN_LENGTH && !IS_ROPE(a) && !IS_ROPE(b)) {
+        char bufferA[SHORT_STRING_MAX], bufferB[SHORT_STRING_MAX];
+        const char* charsA = flatChars(a, bufferA);
+        const char* charsB = flatChars(b, bufferB);
+
+        if (length <= SHORT_STRING_MAX) {
+            char chars[SHORT_STRING_MAX];
+            memcpy(chars, charsA, lengthA);
+            memcpy(chars + lengthA, charsB, lengthB);
+            return shortStringValue(chars, length);
+        }
+
+        ObjString* str = allocateString(vm, length);
+        memcpy(str->chars, charsA, lengthA);
+        memcpy(str->chars + lengthA, charsB, lengthB);
+        return OBJ_VAL(str);
+    }
+
+    ObjRope* rope = (ObjRope*)allocateYoungObj(vm, OBJ_ROPE, sizeof(ObjRope));
+    rope->length = length;
+    rope->left = toObj(vm, a);
+    rope->right = toObj(vm, b);
+    rope->flat = NULL;
+    // The rope ends up old when the nursery is full, its sides may still be young.
+    WRITE_BARRIER(vm, rope, rope->left);
+    WRITE_BARRIER(vm, rope, rope->right);
+    return OBJ_VAL(rope);
+}
+
+ObjString* flattenRope(VM* vm, ObjRope* rope) {
+    if (rope->flat != NULL) return rope->flat;
+
+    ObjString* flat = allocateString(vm, rope->length);
+    char* chars = flat->chars;
+
+    // The buffer is filled back to front, so the right side of every node is popped before its left side.
+    // Appending in a loop builds ropes that lean left, which keeps this stack at two or three entries.
+    int capacity = 8, count = 0;
+    Obj** stack = GROW_ARRAY(Obj*, NULL, 0, capacity);
+    stack[count++] = (Obj*)rope;
+
+    int end = rope->length;
+    while (count > 0) {
+        Obj* node = unwrap(stack[--count]);
+        if (node->type == OBJ_STRING) {
+            ObjString* string = (ObjString*)node;
+            end -= string->length;
+            memcpy(chars + end, string->chars, string->length);
+            continue;
+        }
+
+        if (count + 2 > capacity) {
+            int oldCapacity = capacity;
+            capacity = GROW_CAPACITY(capacity);
+            stack = GROW_ARRAY(Obj*, stack, oldCapacity, capacity);
+        }
+        stack[count++] = ((ObjRope*)node)->left;
+        stack[count++] = ((ObjRope*)node)->right;
+    }
+    FREE_ARRAY(Obj*, stack, capacity);
+
+    rope->flat = flat;
+    rope->left = NULL;
+    rope->right = NULL;
+    WRITE_BARRIER(vm, rope, flat);
+    return rope->flat;
+}
+
+// Strings are only compared by pointer once they are flattened and interned. Short strings compare by value.
+Value canonicalString(VM* vm, Value value) {
+    if (IS_ROPE(value)) return OBJ_VAL(internString(vm, flattenRope(vm, AS_ROPE(value))));
+    if (IS_STRING(value)) return OBJ_VAL(internString(vm, AS_STRING(value)));
+    return value;
+}
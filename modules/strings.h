@@ -7,7 +7,22 @@
 
 #include "object.h"
 
-ObjString* copyString(VM* vm, char* chars, int length);
-ObjString* takeString(VM* vm, char* chars, int length);
+// A Lox string is one of three things. Strings of up to SHORT_STRING_MAX characters are always short
+// strings held in the Value, so they never need an object. Longer ones are an ObjString, or an ObjRope until
+// they are flattened. Only ObjStrings are table keys, which is why names stay ObjStrings however short.
+
+// copyString returns interned strings. Strings created at runtime, by concatenateStrings and flattenRope,
+// are only interned when internString is first called on them.
+ObjString* copyString(VM* vm, const char* chars, int length);
+ObjString* internString(VM* vm, ObjString* str);
+Value stringValue(VM* vm, const char* chars, int length);
+
+// Concatenations shorter than this are copied right away, longer ones build an ObjRope.
+#define ROPE_MIN_LENGTH 64
+
+ObjString* concatenateStrings(VM* vm, ObjString* a, ObjString* b);
+Value concatenate(VM* vm, Value a, Value b);
+ObjString* flattenRope(VM* vm, ObjRope* rope);
+Value canonicalString(VM* vm, Value value);
 
 #endif //CLOX_STRINGS_H
@@ -5,55 +5,373 @@
 #include <stdlib.h>
 #include <string.h>
 #include <iso646.h>
+#include <time.h>
 
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-static uint32_t FNV1FHash(const char* text, int length) {
-    uint32_t hash = FNV1_OFFSET_BASIS;
-    for (int i = 0; i < length; i++) {
-        hash = hash xor (uint8_t)text[i];
-        hash = hash * FNV1_PRIME;
+// A wyhash-style hash: the input is read eight bytes at a time and folded into the state with 64x64->128
+// bit multiplications, which mix far more bits per step than FNV-1a's multiply per byte. The seed is
+// picked at random per VM, so inputs built to collide under one seed don't collide under another.
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r xor (uint64_t)(r >> 64);
+#else
+    uint64_t aHi = a >> 32, aLo = (uint32_t)a, bHi = b >> 32, bLo = (uint32_t)b;
+    uint64_t hh = aHi * bHi, hl = aHi * bLo, lh = aLo * bHi, ll = aLo * bLo;
+    uint64_t middle = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+    uint64_t lo = (middle << 32) | (uint32_t)ll;
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (middle >> 32);
+    return lo xor hi;
+#endif
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hashString(uint64_t seed, const char* text, int length) {
+    const uint8_t* p = (const uint8_t*)text;
+    size_t remaining = (size_t)length;
+    uint64_t a, b;
+
+    seed = seed xor mix(seed xor HASH_P0, HASH_P1);
+    if (remaining <= 16) {
+        if (remaining >= 4) {
+            // Two possibly overlapping pairs of 32-bit reads cover every length from 4 to 16.
+            size_t shift = (remaining >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + remaining - 4) << 32) | read32(p + remaining - 4 - shift);
+        } else if (remaining > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[remaining >> 1] << 8) | p[remaining - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        for (; remaining > 16; p += 16, remaining -= 16) {
+            seed = mix(read64(p) xor HASH_P1, read64(p + 8) xor seed);
+        }
+        a = read64(p + remaining - 16);
+        b = read64(p + remaining - 8);
     }
-    return hash;
+
+    return (uint32_t)mix(HASH_P1 xor (uint64_t)length, mix(a xor HASH_P1, b xor seed) xor HASH_P2);
+}
+
+#ifdef TABLE_STATS
+
+#define COUNT_PROBE(t) ((t)->stats.probes++)
+#define PAUSE_PROBES(t) int pausedProbes = (t)->stats.probes
+#define RESUME_PROBES(t) ((t)->stats.probes = pausedProbes)
+#define INIT_STATS(t) memset(&(t)->stats, 0, sizeof((t)->stats))
+#define BEGIN_RESIZE(t) PAUSE_PROBES(t); clock_t resizeStart = clock()
+#define END_RESIZE(t) \
+    do { \
+        RESUME_PROBES(t); \
+        (t)->stats.resizes++; \
+        (t)->stats.resizeSeconds += (double)(clock() - resizeStart) / CLOCKS_PER_SEC; \
+    } while (false)
+
+#else
+
+#define COUNT_PROBE(t) ((void)(t))
+#define PAUSE_PROBES(t) ((void)0)
+#define RESUME_PROBES(t) ((void)0)
+#define INIT_STATS(t) ((void)0)
+#define BEGIN_RESIZE(t) ((void)0)
+#define END_RESIZE(t) ((void)0)
+
+#endif
+
+// Only a hint, without the builtin the load is just waited for when it comes.
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
+#ifdef SWISS_TABLE
+
+// Group probing in the style of SwissTable. Next to the entries sits an array of control bytes, one per
+// entry. A full entry stores the low 7 bits of its key's hash there, empty and deleted entries have the
+// top bit set. Entries are probed in groups of 16: a single SSE2 compare matches the hash fragment
+// against every control byte of the group, and only the matching entries have their key compared. A
+// group with an empty entry ends the probe sequence.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+// Bit i is set when the i-th control byte of the group matches.
+typedef uint32_t GroupMask;
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) mask |= (GroupMask)(group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+// Matches empty and deleted entries, the ones with the top bit set.
+static inline GroupMask matchFree(const uint8_t* group) {
+#if defined(__SSE2__)
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) mask |= (GroupMask)(group[i] >> 7) << i;
+    return mask;
+#endif
 }
 
-uint32_t hashString(char* text, int length) {
-    return FNV1FHash(text, length);
+static inline int lowestBit(GroupMask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) { mask >>= 1; i++; }
+    return i;
+#endif
 }
 
 void initTable(Table* t) {
     t->capacity = 0;
     t->count = 0;
     t->entries = NULL;
+    t->control = NULL;
+    INIT_STATS(t);
 }
 
 void freeTable(Table *t) {
     FREE_ARRAY(Entry, t->entries, t->capacity);
+    FREE_ARRAY(uint8_t, t->control, t->capacity);
     initTable(t);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
+// Groups are visited in triangular order, which reaches every group when their number is a power of two.
+static int findSlot(Table* t, ObjString* key) {
+    uint8_t h2 = H2(key->hash);
+    uint32_t groupMask = t->capacity / GROUP_SIZE - 1;
+    uint32_t group = H1(key->hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        COUNT_PROBE(t);
+        uint8_t* ctrl = &t->control[group * GROUP_SIZE];
+        for (GroupMask match = matchByte(ctrl, h2); match != 0; match &= match - 1) {
+            int slot = (int)(group * GROUP_SIZE) + lowestBit(match);
+            if (t->entries[slot].key == key) return slot;
+        }
+
+        if (matchByte(ctrl, CTRL_EMPTY) != 0) return -1;
+        group = (group + step) & groupMask;
+    }
+}
+
+static int findFreeSlot(Table* t, uint32_t hash) {
+    uint32_t groupMask = t->capacity / GROUP_SIZE - 1;
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        COUNT_PROBE(t);
+        GroupMask free = matchFree(&t->control[group * GROUP_SIZE]);
+        if (free != 0) return (int)(group * GROUP_SIZE) + lowestBit(free);
+        group = (group + step) & groupMask;
+    }
+}
+
+static void adjustCapacity(Table* t) {
+    BEGIN_RESIZE(t);
+    Table grown;
+    grown.capacity = t->capacity < GROUP_SIZE ? GROUP_SIZE : t->capacity * 2;
+    grown.count = 0;
+    grown.entries = GROW_ARRAY(Entry, NULL, 0, grown.capacity);
+    grown.control = GROW_ARRAY(uint8_t, NULL, 0, grown.capacity);
+    memset(grown.control, CTRL_EMPTY, grown.capacity);
+    for (int i = 0; i < grown.capacity; i++) {
+        grown.entries[i].key = NULL;
+        grown.entries[i].value = NIL_VAL;
+    }
+
+    // Tombstones are dropped on the way.
+    for (int i = 0; i < t->capacity; i++) {
+        if (t->control[i] & 0x80) continue;
+
+        int slot = findFreeSlot(&grown, t->entries[i].key->hash);
+        grown.control[slot] = t->control[i];
+        grown.entries[slot] = t->entries[i];
+        grown.count++;
+    }
+
+    FREE_ARRAY(Entry, t->entries, t->capacity);
+    FREE_ARRAY(uint8_t, t->control, t->capacity);
+    t->entries = grown.entries;
+    t->control = grown.control;
+    t->capacity = grown.capacity;
+    t->count = grown.count;
+    END_RESIZE(t);
+}
+
+static bool setEntry(Table *t, ObjString *key, Value value) {
+    if (t->count + 1 > t->capacity * TABLE_MAX_LOAD) adjustCapacity(t);
+
+    int slot = findSlot(t, key);
+    if (slot >= 0) {
+        t->entries[slot].value = value;
+        return false;
+    }
+
+    // Like the tombstones of the linear probing table, deleted entries stay in count.
+    slot = findFreeSlot(t, key->hash);
+    if (t->control[slot] == CTRL_EMPTY) t->count++;
+
+    t->control[slot] = H2(key->hash);
+    t->entries[slot].key = key;
+    t->entries[slot].value = value;
+    return true;
+}
+
+static Entry* lookup(Table* t, ObjString* key) {
+    if (t->count == 0) return NULL;
+
+    int slot = findSlot(t, key);
+    return slot < 0 ? NULL : &t->entries[slot];
+}
+
+static bool getEntry(Table *t, ObjString *key, Value *value) {
+    Entry* e = lookup(t, key);
+    if (e == NULL) return false;
+
+    *value = e->value;
+    return true;
+}
+
+static bool deleteEntry(Table *t, ObjString *key) {
+    if (t->count == 0) return false;
+
+    int slot = findSlot(t, key);
+    if (slot < 0) return false;
+
+    t->control[slot] = CTRL_DELETED;
+    t->entries[slot].key = NULL;
+    t->entries[slot].value = NIL_VAL;
+    return true;
+}
+
+static ObjString* findInterned(Table* t, const char* chars, int length, uint32_t hash) {
+    if (t->count == 0) return NULL;
+
+    uint8_t h2 = H2(hash);
+    uint32_t groupMask = t->capacity / GROUP_SIZE - 1;
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        COUNT_PROBE(t);
+        uint8_t* ctrl = &t->control[group * GROUP_SIZE];
+        for (GroupMask match = matchByte(ctrl, h2); match != 0; match &= match - 1) {
+            ObjString* key = t->entries[group * GROUP_SIZE + lowestBit(match)].key;
+            if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
+        }
+
+        if (matchByte(ctrl, CTRL_EMPTY) != 0) return NULL;
+        group = (group + step) & groupMask;
+    }
+}
+
+#else
+
+// Empty entries are all zero bits, so new arrays can come zeroed from the allocator. A deleted entry leaves
+// a tombstone behind instead: no key and a true value.
+#define TOMBSTONE_VAL BOOL_VAL(true)
+#define IS_EMPTY(entry) ((entry)->key == NULL && !(IS_BOOL((entry)->value) && AS_BOOL((entry)->value)))
+
+void initTable(Table* t) {
+    t->capacity = 0;
+    t->count = 0;
+    t->entries = NULL;
+#ifdef INCREMENTAL_RESIZE
+    t->oldEntries = NULL;
+    t->oldCapacity = 0;
+    t->migrated = 0;
+#endif
+    INIT_STATS(t);
+}
+
+void freeTable(Table *t) {
+    FREE_ARRAY(Entry, t->entries, t->capacity);
+#ifdef INCREMENTAL_RESIZE
+    FREE_ARRAY(Entry, t->oldEntries, t->oldCapacity);
+#endif
+    initTable(t);
+}
+
+// Capacities are always powers of two (GROW_CAPACITY doubles from 8), so probing wraps around with a mask
+// instead of a division.
+static Entry* findEntry(Table* t, Entry* entries, int capacity, ObjString* key) {
+    uint32_t mask = capacity - 1;
+    uint32_t index = key->hash & mask;
     Entry* tombstone = NULL;
 
     for(;;) {
+        COUNT_PROBE(t);
         Entry* e = &entries[index];
         if (e->key == key) {
             return e;
         }
 
-        // e->key == NULL
-        if (!IS_NIL(e->value)) {
-            // If we've already found a tombstone, we must return it.
-            return tombstone != NULL ? tombstone : e;
+        if (e->key == NULL) {
+            // An empty entry ends the probe sequence. If we've already found a tombstone, we must return it.
+            if (IS_EMPTY(e)) return tombstone != NULL ? tombstone : e;
+            if (tombstone == NULL) tombstone = e;
         }
 
-        if (tombstone == NULL) tombstone = e;
+        index = (index + 1) & mask;
+    }
+}
 
-        index = (index + 1) % capacity;
+static ObjString* findString(Table* t, Entry* entries, int capacity, const char* chars, int length,
+                             uint32_t hash) {
+    uint32_t mask = capacity - 1;
+    uint32_t index = hash & mask;
+    for (;;) {
+        COUNT_PROBE(t);
+        Entry* entry = &entries[index];
+        if (entry->key == NULL) {
+            if (IS_EMPTY(entry)) return NULL;
+        } else if (entry->key->length == length &&
+                   entry->key->hash == hash &&
+                   memcmp(entry->key->chars, chars, length) == 0) {
+            return entry->key;
+        }
+
+        index = (index + 1) & mask;
     }
 }
 
@@ -61,64 +379,259 @@ static bool needsResize(Table* t) {
     return (float)(t->count + 1) / (float)t->capacity > TABLE_MAX_LOAD;
 }
 
+static void insertEntry(Table* t, ObjString* key, Value value) {
+    Entry* dest = findEntry(t, t->entries, t->capacity, key);
+    if (IS_EMPTY(dest)) t->count++;
+    dest->key = key;
+    dest->value = value;
+}
+
+#ifdef INCREMENTAL_RESIZE
+
+// Instead of rehashing every entry at once, a resize only allocates the bigger array. Every tableSet and
+// tableGet then moves the next MIGRATE_STEP entries of the old array over, and lookups check both arrays
+// until it is empty. The old array was at most 3/4 full, so it fills at most 3/8 of the new one, and with
+// two or more entries moved per insert the migration ends long before the new array needs to grow again.
+//
+// Migrating is what makes an operation slow: the keys' hashes are cache misses and the new array's pages
+// are faulted in as entries land on them. Between two resizes 4 / (3 * MIGRATE_STEP) of the inserts
+// migrate, so 256 keeps that to one in 200 and out of the 99th percentile, while bounding the work of any
+// single operation to 256 entries.
+#define MIGRATE_STEP 256
+
+static void migrate(Table* t, int entries) {
+    if (t->oldEntries == NULL) return;
+    PAUSE_PROBES(t);
+
+    int end = t->migrated + entries;
+    if (end > t->oldCapacity) end = t->oldCapacity;
+
+    // Start loading every hash the step needs, instead of waiting for them one insert at a time.
+    for (int i = t->migrated; i < end; i++) {
+        if (t->oldEntries[i].key != NULL) PREFETCH(t->oldEntries[i].key);
+    }
+    for (; t->migrated < end; t->migrated++) {
+        Entry* e = &t->oldEntries[t->migrated];
+        if (e->key == NULL) continue;
+
+        insertEntry(t, e->key, e->value);
+        // Entries further along may have probed past this one.
+        e->key = NULL;
+        e->value = TOMBSTONE_VAL;
+    }
+
+    if (t->migrated == t->oldCapacity) {
+        FREE_ARRAY(Entry, t->oldEntries, t->oldCapacity);
+        t->oldEntries = NULL;
+        t->oldCapacity = 0;
+        t->migrated = 0;
+    }
+    RESUME_PROBES(t);
+}
+
 static void adjustCapacity(Table* t) {
+    BEGIN_RESIZE(t);
+    // The previous migration always ends first (see above), this only keeps that an invariant.
+    migrate(t, t->oldCapacity);
+
     int capacity = GROW_CAPACITY(t->capacity);
-    Entry* entries = (Entry*)malloc(sizeof(Entry) * capacity);
+    t->oldEntries = t->entries;
+    t->oldCapacity = t->capacity;
+    t->migrated = 0;
 
+    t->entries = ALLOCATE_ZEROED(Entry, capacity);
+    t->capacity = capacity;
     t->count = 0;
-    for (int i = 0; i < t->capacity; ++i) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+    END_RESIZE(t);
+}
+
+static Entry* lookup(Table* t, ObjString* key) {
+    if (t->count != 0) {
+        Entry* e = findEntry(t, t->entries, t->capacity, key);
+        if (e->key != NULL) return e;
+    }
+
+    if (t->oldEntries != NULL) {
+        Entry* e = findEntry(t, t->oldEntries, t->oldCapacity, key);
+        if (e->key != NULL) return e;
+    }
+
+    return NULL;
+}
+
+static bool setEntry(Table *t, ObjString *key, Value value) {
+    migrate(t, MIGRATE_STEP);
+    if (needsResize(t)) adjustCapacity(t);
+
+    Entry* entry = findEntry(t, t->entries, t->capacity, key);
+    bool isNew = entry->key == NULL;
+
+    if (isNew && t->oldEntries != NULL) {
+        // The key may not have been migrated yet. Move it now, so it never lives in both arrays.
+        Entry* old = findEntry(t, t->oldEntries, t->oldCapacity, key);
+        if (old->key != NULL) {
+            old->key = NULL;
+            old->value = TOMBSTONE_VAL;
+            isNew = false;
+        }
+    }
+
+    if (IS_EMPTY(entry)) t->count++;
+    entry->key = key;
+    entry->value = value;
+    return isNew;
+}
+
+static bool getEntry(Table *t, ObjString *key, Value *value) {
+    migrate(t, MIGRATE_STEP);
+
+    Entry* e = lookup(t, key);
+    if (e == NULL) return false;
+
+    *value = e->value;
+    return true;
+}
+
+static bool deleteEntry(Table *t, ObjString *key) {
+    Entry* e = lookup(t, key);
+    if (e == NULL) return false;
+
+    // Leave a tombstone so probe sequences passing through this entry keep going.
+    e->key = NULL;
+    e->value = TOMBSTONE_VAL;
+    return true;
+}
+
+static ObjString* findInterned(Table* t, const char* chars, int length, uint32_t hash) {
+    if (t->count != 0) {
+        ObjString* key = findString(t, t->entries, t->capacity, chars, length, hash);
+        if (key != NULL) return key;
+    }
+
+    if (t->oldEntries == NULL) return NULL;
+    return findString(t, t->oldEntries, t->oldCapacity, chars, length, hash);
+}
+
+#else
 
-        if (t->entries == NULL || t->entries[i].key == NULL) {
+static void adjustCapacity(Table* t) {
+    BEGIN_RESIZE(t);
+    Entry* old = t->entries;
+    int oldCapacity = t->capacity;
+
+    t->capacity = GROW_CAPACITY(t->capacity);
+    t->entries = ALLOCATE_ZEROED(Entry, t->capacity);
+    t->count = 0;
+    for (int i = 0; i < oldCapacity; ++i) {
+        if (old[i].key == NULL) {
             continue;
         }
 
-        Entry e = t->entries[i];
-        Entry* dest = findEntry(entries, capacity, e.key);
-        dest->key = e.key;
-        dest->value = e.value;
-        t->count++;
+        insertEntry(t, old[i].key, old[i].value);
     }
 
-    FREE_ARRAY(Entry, t->entries, t->capacity);
-    t->capacity = capacity;
-    t->entries = entries;
+    FREE_ARRAY(Entry, old, oldCapacity);
+    END_RESIZE(t);
 }
 
-bool tableSet(Table *t, ObjString *key, Value value) {
+static bool setEntry(Table *t, ObjString *key, Value value) {
     if (needsResize(t)) adjustCapacity(t);
 
-    Entry* entry = findEntry(t->entries, t->capacity, key);
+    Entry* entry = findEntry(t, t->entries, t->capacity, key);
     bool isNew = entry->key == NULL;
-    if (isNew && !IS_NIL(entry->value)) t->count++;
+    if (IS_EMPTY(entry)) t->count++;
 
     entry->key = key;
     entry->value = value;
     return isNew;
 }
 
-bool tableGet(Table *t, ObjString *key, Value *value) {
-    if (t->count == 0) return false;
+static Entry* lookup(Table* t, ObjString* key) {
+    if (t->count == 0) return NULL;
 
-    Entry* e = findEntry(t->entries, t->capacity, key);
-    if (e->key == NULL) return false;
+    Entry* e = findEntry(t, t->entries, t->capacity, key);
+    return e->key == NULL ? NULL : e;
+}
+
+static bool getEntry(Table *t, ObjString *key, Value *value) {
+    Entry* e = lookup(t, key);
+    if (e == NULL) return false;
 
     *value = e->value;
     return true;
 }
 
-bool tableDelete(Table *t, ObjString *key) {
+static bool deleteEntry(Table *t, ObjString *key) {
     if (t->count == 0) return false;
 
-    Entry* e = findEntry(t->entries, t->capacity, key);
+    Entry* e = findEntry(t, t->entries, t->capacity, key);
     if (e->key == NULL) return false;
 
-    e->key == NULL;
-    e->value = NIL_VAL;
+    // Leave a tombstone so probe sequences passing through this entry keep going.
+    e->key = NULL;
+    e->value = TOMBSTONE_VAL;
     return true;
 }
 
+static ObjString* findInterned(Table* t, const char* chars, int length, uint32_t hash) {
+    if (t->count == 0) return NULL;
+    return findString(t, t->entries, t->capacity, chars, length, hash);
+}
+
+#endif
+
+#endif
+
+#ifdef TABLE_STATS
+
+static void recordLookup(Table* t, bool hit) {
+    t->stats.lookups++;
+    if (hit) t->stats.hits++;
+    else t->stats.misses++;
+
+    int bucket = 0;
+    while (bucket < TABLE_PROBE_BUCKETS - 1 && (2 << bucket) <= t->stats.probes) bucket++;
+    t->stats.probeHistogram[bucket]++;
+}
+
+#define BEGIN_LOOKUP(t) ((t)->stats.probes = 0)
+#define END_LOOKUP(t, hit) recordLookup(t, hit)
+
+#else
+
+#define BEGIN_LOOKUP(t) ((void)0)
+#define END_LOOKUP(t, hit) ((void)0)
+
+#endif
+
+bool tableSet(Table *t, ObjString *key, Value value) {
+    BEGIN_LOOKUP(t);
+    bool isNew = setEntry(t, key, value);
+    END_LOOKUP(t, !isNew);
+    return isNew;
+}
+
+bool tableGet(Table *t, ObjString *key, Value *value) {
+    BEGIN_LOOKUP(t);
+    bool found = getEntry(t, key, value);
+    END_LOOKUP(t, found);
+    return found;
+}
+
+bool tableDelete(Table *t, ObjString *key) {
+    BEGIN_LOOKUP(t);
+    bool found = deleteEntry(t, key);
+    END_LOOKUP(t, found);
+    return found;
+}
+
+ObjString* tableFindString(Table* t, const char* chars, int length, uint32_t hash) {
+    BEGIN_LOOKUP(t);
+    ObjString* key = findInterned(t, chars, length, hash);
+    END_LOOKUP(t, key != NULL);
+    return key;
+}
+
 void tableCopy(Table *from, Table *to) {
     for (int i = 0; i < from->capacity; i++) {
         Entry* entry = &from->entries[i];
@@ -126,24 +639,136 @@ void tableCopy(Table *from, Table *to) {
             tableSet(to, entry->key, entry->value);
         }
     }
+#ifdef INCREMENTAL_RESIZE
+    for (int i = 0; i < from->oldCapacity; i++) {
+        Entry* entry = &from->oldEntries[i];
+        if (entry->key != NULL) {
+            tableSet(to, entry->key, entry->value);
+        }
+    }
+#endif
 }
 
-ObjString* tableFindString(Table* t, const char* chars, int length, uint32_t hash) {
-    if (t->count == 0) return NULL;
+// Leaves the same tombstone tableDelete would, without the lookup. Under INCREMENTAL_RESIZE going through
+// tableDelete would also migrate entries while the collector is iterating over them.
+static void removeEntry(Table* t, Entry* entries, int i) {
+    entries[i].key = NULL;
+#ifdef SWISS_TABLE
+    t->control[i] = CTRL_DELETED;
+    entries[i].value = NIL_VAL;
+#else
+    (void)t;
+    entries[i].value = TOMBSTONE_VAL;
+#endif
+}
 
-    uint32_t index = (hash % t->capacity);
-    for (;;) {
-        Entry* entry = &t->entries[index];
-        if (entry->key == NULL) {
-            if (!IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                   entry->key->hash == hash &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            return entry->key;
+static void markEntries(VM* vm, Entry* entries, int capacity) {
+    for (int i = 0; i < capacity; i++) {
+        markObject(vm, (Obj*)entries[i].key);
+        markValue(vm, entries[i].value);
+    }
+}
+
+void markTable(VM* vm, Table* t) {
+    markEntries(vm, t->entries, t->capacity);
+#ifdef INCREMENTAL_RESIZE
+    markEntries(vm, t->oldEntries, t->oldCapacity);
+#endif
+}
+
+#ifdef NURSERY
+
+static void evacuateEntries(VM* vm, Entry* entries, int capacity) {
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = (ObjString*)evacuateObject(vm, (Obj*)entries[i].key);
+        entries[i].value = evacuateValue(vm, entries[i].value);
+    }
+}
+
+// Keys are placed by their hash, not their address, so moved keys can be updated where they are.
+void evacuateTable(VM* vm, Table* t) {
+    evacuateEntries(vm, t->entries, t->capacity);
+#ifdef INCREMENTAL_RESIZE
+    evacuateEntries(vm, t->oldEntries, t->oldCapacity);
+#endif
+}
+
+// Only looks up the given keys, so the cost follows what was interned since the last minor collection and not
+// the size of the table. The dead keys are still intact, their hash leads to their entry.
+void tableSweepNursery(Table* t, Obj** keys, int count) {
+    for (int i = 0; i < count; i++) {
+        ObjString* key = (ObjString*)keys[i];
+        if (key->obj.next == NULL) {
+            deleteEntry(t, key);
+            continue;
         }
 
-        index = (index + 1 % t->capacity);
+        Entry* e = lookup(t, key);
+        if (e != NULL) e->key = (ObjString*)key->obj.next;
     }
 }
 
+#endif
 
+static void removeWhite(Table* t, Entry* entries, int capacity) {
+    for (int i = 0; i < capacity; i++) {
+        if (entries[i].key != NULL && !entries[i].key->obj.isMarked) removeEntry(t, entries, i);
+    }
+}
+
+void tableRemoveWhite(Table* t) {
+    removeWhite(t, t->entries, t->capacity);
+#ifdef INCREMENTAL_RESIZE
+    removeWhite(t, t->oldEntries, t->oldCapacity);
+#endif
+}
+
+int tableTombstones(Table* t) {
+    int tombstones = 0;
+    for (int i = 0; i < t->capacity; i++) {
+#ifdef SWISS_TABLE
+        if (t->control[i] == CTRL_DELETED) tombstones++;
+#else
+        if (t->entries[i].key == NULL && !IS_EMPTY(&t->entries[i])) tombstones++;
+#endif
+    }
+#ifdef INCREMENTAL_RESIZE
+    // Migrated entries leave tombstones in the old array too, but those go away with it.
+    for (int i = t->migrated; i < t->oldCapacity; i++) {
+        if (t->oldEntries[i].key == NULL && !IS_EMPTY(&t->oldEntries[i])) tombstones++;
+    }
+#endif
+    return tombstones;
+}
+
+size_t tableBytes(Table* t) {
+    size_t bytes = sizeof(Entry) * t->capacity;
+#ifdef SWISS_TABLE
+    bytes += sizeof(uint8_t) * t->capacity;
+#endif
+#ifdef INCREMENTAL_RESIZE
+    bytes += sizeof(Entry) * t->oldCapacity;
+#endif
+    return bytes;
+}
+
+void printTableStats(const char* name, Table* t) {
+    fprintf(stderr, "table %s: %d entries in %d slots (load %.2f), %d tombstones\n", name, t->count, t->capacity,
+            t->capacity == 0 ? 0.0 : (double)t->count / t->capacity, tableTombstones(t));
+#ifdef TABLE_STATS
+    TableStats* stats = &t->stats;
+    fprintf(stderr, "  %llu lookups, %llu hits, %llu misses\n", (unsigned long long)stats->lookups,
+            (unsigned long long)stats->hits, (unsigned long long)stats->misses);
+    fprintf(stderr, "  %d resizes, %.3f ms in adjustCapacity\n", stats->resizes, stats->resizeSeconds * 1e3);
+    fprintf(stderr, "  probe length histogram:\n");
+    for (int i = 0; i < TABLE_PROBE_BUCKETS; i++) {
+        if (stats->probeHistogram[i] == 0) continue;
+
+        int low = i == 0 ? 0 : 1 << i;
+        if (i == TABLE_PROBE_BUCKETS - 1) fprintf(stderr, "    %5d+     %llu\n", low, (unsigned long long)stats->probeHistogram[i]);
+        else fprintf(stderr, "    %5d-%-5d %llu\n", low, (2 << i) - 1, (unsigned long long)stats->probeHistogram[i]);
+    }
+#else
+    fprintf(stderr, "  built without TABLE_STATS, no lookup counters\n");
+#endif
+}
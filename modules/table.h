@@ -9,8 +9,6 @@
 #include "common.h"
 #include "value.h"
 
-#define FNV1_OFFSET_BASIS 2166136261
-#define FNV1_PRIME 16777619
 #define TABLE_MAX_LOAD 0.75
 
 typedef struct {
@@ -18,13 +16,42 @@ typedef struct {
     Value value;
 } Entry;
 
+// Probe lengths are bucketed by powers of two: up to 1, 2-3, 4-7 and so on, the last bucket takes the rest.
+#define TABLE_PROBE_BUCKETS 10
+
+// Counters kept per table when built with TABLE_STATS. A lookup is any tableGet, tableSet, tableDelete or
+// tableFindString; for tableSet a hit means the key was already there.
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t probeHistogram[TABLE_PROBE_BUCKETS];
+    int resizes;
+    double resizeSeconds; // Processor time spent in adjustCapacity.
+    // Entries examined by the lookup in progress, or groups of entries for the SwissTable backend. Probes
+    // made while resizing or migrating entries aren't charged to the lookup that triggered them.
+    int probes;
+} TableStats;
+
 typedef struct Table {
     int count;
     int capacity;
     Entry* entries;
+#ifdef SWISS_TABLE
+    uint8_t* control; // One byte of metadata per entry, see table.c.
+#endif
+#ifdef INCREMENTAL_RESIZE
+    // While a resize is in progress, the entries not yet moved into `entries`.
+    Entry* oldEntries;
+    int oldCapacity;
+    int migrated; // Entries of oldEntries below this index have already been moved.
+#endif
+#ifdef TABLE_STATS
+    TableStats stats;
+#endif
 } Table;
 
-uint32_t hashString(char* text, int length);
+uint32_t hashString(uint64_t seed, const char* text, int length);
 
 void initTable(Table* t);
 void freeTable(Table* t);
@@ -34,4 +61,17 @@ bool tableDelete(Table* t, ObjString* key);
 void tableCopy(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 
+void markTable(VM* vm, Table* t);
+#ifdef NURSERY
+void evacuateTable(VM* vm, Table* t);
+// Forgets the young keys among keys that didn't survive the nursery and points the entries of the rest at
+// their copies.
+void tableSweepNursery(Table* t, Obj** keys, int count);
+#endif
+void tableRemoveWhite(Table* t); // Deletes every key the collector didn't mark.
+
+int tableTombstones(Table* t);
+size_t tableBytes(Table* t); // What the arrays of the table take, a resize in progress included.
+void printTableStats(const char* name, Table* t); // To stderr.
+
 #endif //CLOX_TABLE_H
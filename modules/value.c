@@ -31,11 +31,18 @@ void freeValueArray(ValueArray* array) {
 }
 
 void printValue(Value value) {
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
         case VAL_NIL: printf("nil"); break;
         case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
         case VAL_OBJ: printObject(value); break;
+        case VAL_SHORT_STRING: {
+            char chars[SHORT_STRING_MAX];
+            int length = shortStringChars(value, chars);
+            printf("%.*s", length, chars);
+            break;
+        }
+        case VAL_UNDEFINED: break; // Unreachable.
     }
 }
 
@@ -5,30 +5,124 @@
 #ifndef CLOX_VALUE_H
 #define CLOX_VALUE_H
 
+#include <string.h>
+
+#include "common.h"
+
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjFunction ObjFunction;
+typedef struct VM VM;
+
+// Declared here rather than in object.h so the VM can keep statistics per type.
+typedef enum {
+    OBJ_STRING,
+    OBJ_FUNCTION,
+    OBJ_ROPE,
+} ObjType;
+
+#define OBJ_TYPE_COUNT (OBJ_ROPE + 1)
 
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_SHORT_STRING, // Up to SHORT_STRING_MAX characters stored in the Value itself.
+    VAL_UNDEFINED, // Marks a global slot that hasn't been defined yet. Never reaches the stack.
 } ValueType;
 
+#ifdef NAN_BOXING
+
+// Every double that isn't a quiet NaN is stored as is. The remaining quiet NaN space holds
+// the singletons (nil, true, false) in the low bits and object pointers in the low 48 bits
+// with the sign bit set. Short strings set bit 49 instead and keep their characters in the
+// low 48 bits, one per byte from the lowest, padded with zero bytes.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1 // 01.
+#define TAG_FALSE 2 // 10.
+#define TAG_TRUE  3 // 11.
+#define TAG_UNDEFINED 4 // 100.
+#define SHORT_STRING_BIT ((uint64_t)1 << 49)
+#define SHORT_STRING_MAX 6
+
+typedef uint64_t Value;
+
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_SHORT_STRING(value) \
+    (((value) & (SIGN_BIT | QNAN | SHORT_STRING_BIT)) == (QNAN | SHORT_STRING_BIT))
+
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_NUMBER(value)  valueToNum(value)
+#define AS_OBJ(value)     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)   numToValue(num)
+#define OBJ_VAL(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+#define VALUE_TYPE(value) \
+    (IS_NUMBER(value) ? VAL_NUMBER : IS_OBJ(value) ? VAL_OBJ : IS_SHORT_STRING(value) ? VAL_SHORT_STRING : \
+     IS_NIL(value) ? VAL_NIL : VAL_BOOL)
+
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+static inline Value shortStringValue(const char* chars, int length) {
+    Value value = QNAN | SHORT_STRING_BIT;
+    for (int i = 0; i < length; i++) value |= (uint64_t)(uint8_t)chars[i] << (8 * i);
+    return value;
+}
+
+// Copies the characters of a short string to chars, which must fit SHORT_STRING_MAX, and returns how many.
+static inline int shortStringChars(Value value, char* chars) {
+    int length = 0;
+    for (; length < SHORT_STRING_MAX; length++) {
+        char c = (char)(value >> (8 * length));
+        if (c == '\0') break;
+        chars[length] = c;
+    }
+    return length;
+}
+
+#else
+
 typedef struct Value {
     ValueType type;
     union {
         bool boolean;
         double number;
         Obj* obj;
+        char shortChars[8]; // Padded with zero bytes.
     } as;
 } Value;
 
+#define SHORT_STRING_MAX 8
+
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
+#define IS_SHORT_STRING(value) ((value).type == VAL_SHORT_STRING)
 
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_NUMBER(value)  ((value).as.number)
@@ -36,15 +130,70 @@ typedef struct Value {
 
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
+#define UNDEFINED_VAL     ((Value){VAL_UNDEFINED, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+#define VALUE_TYPE(value) ((value).type)
+
+static inline Value shortStringValue(const char* chars, int length) {
+    Value value = {VAL_SHORT_STRING, {.number = 0}};
+    memcpy(value.as.shortChars, chars, length);
+    return value;
+}
+
+// Copies the characters of a short string to chars, which must fit SHORT_STRING_MAX, and returns how many.
+static inline int shortStringChars(Value value, char* chars) {
+    int length = 0;
+    while (length < SHORT_STRING_MAX && value.as.shortChars[length] != '\0') length++;
+    memcpy(chars, value.as.shortChars, length);
+    return length;
+}
+
+#endif
+
 typedef struct {
     int capacity;
     int count;
     Value* values;
 } ValueArray;
 
+// Shared by run() and the compiler's constant folding so both agree on the result.
+static inline bool isFalsey(Value v) {
+    return IS_NIL(v) || (IS_BOOL(v) && !AS_BOOL(v));
+}
+
+static inline bool valuesEqual(Value a, Value b) {
+    switch (VALUE_TYPE(a)) {
+        case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NIL:    return true;
+        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_OBJ:    return IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b);
+#ifdef NAN_BOXING
+        case VAL_SHORT_STRING: return a == b;
+#else
+        case VAL_SHORT_STRING: return IS_SHORT_STRING(b) && memcmp(a.as.shortChars, b.as.shortChars, 8) == 0;
+#endif
+        default:         return false; // Unreachable.
+    }
+}
+
+static inline bool valuesGreater(Value a, Value b) {
+    switch (VALUE_TYPE(a)) {
+        case VAL_BOOL:   return AS_BOOL(a) > AS_BOOL(b);
+        case VAL_NUMBER: return AS_NUMBER(a) > AS_NUMBER(b);
+        default:         return false; // nil and objects have no order.
+    }
+}
+
+static inline bool valuesLesser(Value a, Value b) {
+    switch (VALUE_TYPE(a)) {
+        case VAL_BOOL:   return AS_BOOL(a) < AS_BOOL(b);
+        case VAL_NUMBER: return AS_NUMBER(a) < AS_NUMBER(b);
+        default:         return false; // nil and objects have no order.
+    }
+}
+
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
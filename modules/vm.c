@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "object.h"
 #include "memory.h"
@@ -39,10 +40,6 @@ static void freeStack(Stack stack) {
 
 }
 
-static bool isFalsey(Value v) {
-    return IS_NIL(v) || (IS_BOOL(v) && !AS_BOOL(v));
-}
-
 
 static void runtimeError(VM* vm, const char* format, ...) {
     va_list args;
@@ -58,39 +55,83 @@ static void runtimeError(VM* vm, const char* format, ...) {
     resetStack(&vm->stack);
 }
 
+// Falls back to the clock and the VM's address (randomized by ASLR) where /dev/urandom isn't available.
+static uint64_t randomSeed(VM* vm) {
+    uint64_t seed;
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (urandom != NULL) {
+        size_t read = fread(&seed, sizeof(seed), 1, urandom);
+        fclose(urandom);
+        if (read == 1) return seed;
+    }
+
+    return ((uint64_t)time(NULL) << 32) ^ (uint64_t)clock() ^ (uint64_t)(uintptr_t)vm;
+}
+
 VM* initVM() {
     VM* vm = (VM*)malloc(sizeof(VM));
     if (vm == NULL) {
         exit(1);
     }
+    vm->objects = NULL;
+    vm->bytesAllocated = 0;
+    vm->nextGC = 0;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+    vm->gcPhase = GC_IDLE;
+    vm->sweepCursor = NULL;
+    memset(&vm->gcStats, 0, sizeof(vm->gcStats));
+    memset(&vm->memStats, 0, sizeof(vm->memStats));
+#ifdef POOL_ALLOCATOR
+    initPool(&vm->pool);
+#endif
+    setAllocatingVM(vm);
+#ifdef NURSERY
+    initNursery(&vm->nursery);
+#endif
+    setGCPauseBudget(vm, 500);
 
     resetStack(&vm->stack);
+    initArena(&vm->stringArena);
     initTable(&vm->strings);
+    vm->hashSeed = randomSeed(vm);
     initTable(&vm->globals);
-    vm->objects = NULL;
+    initValueArray(&vm->globalNames);
+    initValueArray(&vm->globalValues);
     vm->frameCount = 0;
+    vm->traceExecution = false;
+    vm->printCode = false;
     return vm;
 }
 
+// Everything is given back to the pool of vm, whichever VM was allocating when this was called.
 void freeVM(VM* vm) {
-    freeObjects(vm->objects);
+    VM* previous = setAllocatingVM(vm);
+    freeObjects(vm);
+#ifdef NURSERY
+    freeNursery(&vm->nursery);
+#endif
+    freeArena(&vm->stringArena);
     freeTable(&vm->strings);
     freeTable(&vm->globals);
+    freeValueArray(&vm->globalNames);
+    freeValueArray(&vm->globalValues);
+    setAllocatingVM(previous == vm ? NULL : previous);
+#ifdef POOL_ALLOCATOR
+    freePool(&vm->pool);
+#endif
     free(vm);
 }
 
-static uint8_t READ_BYTE(CallFrame* frame) {
-    return *frame->ip++;
-}
-
-static uint16_t READ_16_BYTE(CallFrame* frame) {
-    uint8_t first = READ_BYTE(frame);
-    uint8_t second = READ_BYTE(frame);
-    return (uint16_t)((first << 8) | second);
-}
+int globalSlot(VM* vm, ObjString* name) {
+    Value slot;
+    if (tableGet(&vm->globals, name, &slot)) return (int)AS_NUMBER(slot);
 
-static Value READ_CONSTANT(CallFrame* frame) {
-    return frame->function->chunk.constants.values[READ_BYTE(frame)];
+    writeValueArray(&vm->globalNames, OBJ_VAL(name));
+    writeValueArray(&vm->globalValues, UNDEFINED_VAL);
+    tableSet(&vm->globals, name, NUMBER_VAL(vm->globalValues.count - 1));
+    return vm->globalValues.count - 1;
 }
 
 static void printStack(Stack* stack) {
@@ -103,191 +144,196 @@ static void printStack(Stack* stack) {
     printf("\n");
 }
 
-static bool validateNumbers(VM* vm, CallFrame* frame, Value a, Value b) {
-    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
-        runtimeError(vm, "Operands must be a numbers.");
-        return false;
-    }
-    return true;
-}
-
-static bool validateEqualType(VM* vm, CallFrame* frame, Value a, Value b) {
-    if (a.type != b.type) {
-        runtimeError(vm, "Operands must be of the same type.");
-        return false;
-    }
-    return true;
-}
-
-typedef void (*BinaryFn)(VM* vm, Value a, Value b);
-
-static void equalOp(VM* vm, Value a, Value b) {
-    switch (a.type) {
-        case VAL_BOOL:   push(&vm->stack, BOOL_VAL(AS_BOOL(a) == AS_BOOL(b))); break;
-        case VAL_NIL:    push(&vm->stack, BOOL_VAL(true)); break;
-        case VAL_NUMBER: push(&vm->stack, BOOL_VAL(AS_NUMBER(a) == AS_NUMBER(b))); break;
-        case VAL_OBJ:    push(&vm->stack, BOOL_VAL(AS_OBJ(a) == AS_OBJ(b))); break;
-        default: return; // Unreachable.
-    }
-}
-
-static void greaterOp(VM* vm, Value a, Value b) {
-    switch (a.type) {
-        case VAL_BOOL:   push(&vm->stack, BOOL_VAL(AS_BOOL(a) > AS_BOOL(b))); break;
-        case VAL_NIL:    push(&vm->stack, BOOL_VAL(false)); break;
-        case VAL_NUMBER: push(&vm->stack, BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b))); break;
-        default:         false; // Unreachable.
-    }
-}
-
-static void lesserOp(VM* vm, Value a, Value b) {
-    switch (a.type) {
-        case VAL_BOOL:   push(&vm->stack, BOOL_VAL(AS_BOOL(a) < AS_BOOL(b))); break;
-        case VAL_NIL:    push(&vm->stack, BOOL_VAL(false)); break;
-        case VAL_NUMBER: push(&vm->stack, BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b))); break;
-        default:         false; // Unreachable.
-    }
-}
-
-static void substractOp(VM* vm, Value a, Value b) {
-    push(&vm->stack, NUMBER_VAL(AS_NUMBER(a)-AS_NUMBER(b)));
-}
-
-static void multiplyOp(VM* vm, Value a, Value b) {
-    push(&vm->stack, NUMBER_VAL(AS_NUMBER(a)*AS_NUMBER(b)));
-}
-
-static void divideOp(VM* vm, Value a, Value b) {
-    push(&vm->stack, NUMBER_VAL(AS_NUMBER(a)/AS_NUMBER(b)));
-}
-static bool binaryOp(VM* vm, CallFrame* frame, ValueType type, BinaryFn op) {
-    Value b = pop(&vm->stack);
-    Value a = pop(&vm->stack);
-    if (type == VAL_NUMBER && !validateNumbers(vm, frame, a, b)) return false;
-    if (type == VAL_BOOL && !validateEqualType(vm, frame, a, b)) return false;
-    op(vm, a, b);
-    return true;
-}
+// run() keeps the instruction pointer, the stack top and the frame's slot base in locals so they can
+// live in registers. They are written back to the CallFrame and the Stack only when something outside
+// the loop needs them: a runtime error, tracing, or leaving run().
+#define READ_BYTE()     (*ip++)
+#define READ_16_BYTE()  (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_24_BYTE()  (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT_LONG() (frame->function->chunk.constants.values[READ_24_BYTE()])
+
+// With TOS_CACHING the top of the stack is kept in the local tos and sp points at the slot it would
+// occupy in Stack.values. Opcodes that read the stack through other pointers (locals through slots,
+// tracing, errors) spill it first.
+#ifdef TOS_CACHING
+#define LOAD_TOP()              (tos = *--sp)
+#define SPILL_TOP()             (*sp = tos)
+#define STACK_TOP()             (sp + 1)
+#define PUSH(value)             (*sp++ = tos, tos = (value))
+#define POP()                   (popped = tos, tos = *--sp, popped)
+#define DROP()                  (tos = *--sp)
+#define RELOAD_TOP()            (tos = *sp)
+#define TOP                     tos
+#define SECOND                  (sp[-1])
+#define REPLACE_TOP_TWO(value)  (tos = (value), sp--)
+#else
+#define LOAD_TOP()              ((void)0)
+#define SPILL_TOP()             ((void)0)
+#define STACK_TOP()             (sp)
+#define PUSH(value)             (*sp++ = (value))
+#define POP()                   (*--sp)
+#define DROP()                  (--sp)
+#define RELOAD_TOP()            ((void)0)
+#define TOP                     (sp[-1])
+#define SECOND                  (sp[-2])
+#define REPLACE_TOP_TWO(value)  (sp[-2] = (value), sp--)
+#endif
 
-// {var a = "a"; var b="b"; print(a + " " + b);}
-static InterpretResult run(VM* vm) {
-    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+#define STORE_FRAME() \
+    do { \
+        frame->ip = ip; \
+        SPILL_TOP(); \
+        vm->stack.top = STACK_TOP(); \
+    } while (false)
+
+#define RUNTIME_ERROR(...) \
+    do { \
+        STORE_FRAME(); \
+        runtimeError(vm, __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+
+// Binary operators check both operands where they are on the stack and overwrite the left one with the
+// result, so the only stack movement is dropping the right operand.
+#define NUMBER_OP(valueType, op) \
+    do { \
+        Value b = TOP; \
+        Value a = SECOND; \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) RUNTIME_ERROR("Operands must be a numbers."); \
+        REPLACE_TOP_TWO(valueType(AS_NUMBER(a) op AS_NUMBER(b))); \
+    } while (false)
+
+// Only equality looks at what strings contain, so only == and != canonicalize them, which may flatten a
+// rope and allocate. Objects have no order, < and > on them are false without looking any further.
+#define COMPARE(result, op, compareFn, canonicalize) \
+    do { \
+        Value b = TOP; \
+        Value a = SECOND; \
+        if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            result = AS_NUMBER(a) op AS_NUMBER(b); \
+        } else { \
+            if (VALUE_TYPE(a) != VALUE_TYPE(b) && !(IS_ANY_STRING(a) && IS_ANY_STRING(b))) { \
+                RUNTIME_ERROR("Operands must be of the same type."); \
+            } \
+            if (canonicalize) { \
+                if (IS_OBJ(a)) a = canonicalString(vm, a); \
+                if (IS_OBJ(b)) b = canonicalString(vm, b); \
+                result = compareFn(a, b); \
+                GC_SAFEPOINT(); \
+            } else { \
+                result = compareFn(a, b); \
+            } \
+        } \
+    } while (false)
+
+#define COMPARISON_OP(op, compareFn) \
+    do { \
+        bool result; \
+        COMPARE(result, op, compareFn, false); \
+        REPLACE_TOP_TWO(BOOL_VAL(result)); \
+    } while (false)
+
+#define EQUALITY_OP(op, compareFn) \
+    do { \
+        bool result; \
+        COMPARE(result, op, compareFn, true); \
+        REPLACE_TOP_TWO(BOOL_VAL(result)); \
+    } while (false)
+
+// Only reached after instructions that allocate. Collecting inside the allocation itself could free the
+// operands the instruction is still combining. Survivors of the nursery move, so the cached top of the
+// stack is read back from the stack afterwards.
+#define GC_SAFEPOINT() \
+    do { \
+        if (SHOULD_COLLECT(vm)) { \
+            STORE_FRAME(); \
+            collectGarbage(vm); \
+            RELOAD_TOP(); \
+        } \
+    } while (false)
+
+#define GET_GLOBAL(slot) \
+    do { \
+        Value value = globals[slot]; \
+        if (IS_UNDEFINED(value)) { \
+            RUNTIME_ERROR("Undefined variable '%s.", AS_CSTRING(vm->globalNames.values[slot])); \
+        } \
+        PUSH(value); \
+    } while (false)
+
+#define SET_GLOBAL(slot) \
+    do { \
+        if (IS_UNDEFINED(globals[slot])) { \
+            RUNTIME_ERROR("Undefined variable '%s.", AS_CSTRING(vm->globalNames.values[slot])); \
+        } \
+        globals[slot] = TOP; \
+    } while (false)
+
+#if defined(COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define THREADED_DISPATCH
+#endif
 
-    for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    printStack(&vm->stack);
-    // disassembleInstruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code));
+// With THREADED_DISPATCH every handler ends in its own indirect jump through dispatchTable, which gives
+// the branch predictor one site per opcode instead of the single shared jump of the switch.
+#ifdef THREADED_DISPATCH
+#define DISPATCH() goto *dispatchTable[instruction = READ_BYTE()];
+#define CASE(op)   label_##op
+#define NEXT       do { TRACE_INSTRUCTION(); DISPATCH() } while (false)
+#else
+#define DISPATCH() switch (instruction = READ_BYTE())
+#define CASE(op)   case op
+#define NEXT       break
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE(frame)) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT(frame);
-                push(&vm->stack, constant);
-                break;
-            }
-            case OP_NIL: push(&vm->stack, NIL_VAL); break;
-            case OP_TRUE: push(&vm->stack, BOOL_VAL(true)); break;
-            case OP_FALSE: push(&vm->stack, BOOL_VAL(false)); break;
-            case OP_EQUAL: if (!binaryOp(vm, frame, VAL_BOOL, equalOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_GREATER: if (!binaryOp(vm, frame, VAL_BOOL, greaterOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_LESSER: if (!binaryOp(vm, frame, VAL_BOOL, lesserOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_ADD: {
-                Value b = pop(&vm->stack);
-                Value a = pop(&vm->stack);
-                if (IS_STRING(a) && IS_STRING(b)) {
-                    ObjString* strA = AS_STRING(a);
-                    ObjString* strB =  AS_STRING(b);
-
-                    int length = strA->length + strB->length;
-                    char* concat = (char*)malloc(length);
-                    memcpy(concat, strA->chars, strA->length);
-                    memcpy(concat+strA->length, strB->chars, strB->length);
-
-                    push(&vm->stack, OBJ_VAL(takeString(vm, concat, length)));
-                } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
-                    push(&vm->stack, NUMBER_VAL(AS_NUMBER(a)+AS_NUMBER(b)));
-                } else {
-                    runtimeError(vm, "Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SUBTRACT: if (!binaryOp(vm, frame, VAL_NUMBER, substractOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_MULTIPLY: if (!binaryOp(vm, frame, VAL_NUMBER, multiplyOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_DIVIDE: if (!binaryOp(vm, frame, VAL_NUMBER, divideOp)) return INTERPRET_RUNTIME_ERROR; break;
-            case OP_NOT: push(&vm->stack, BOOL_VAL(isFalsey(pop(&vm->stack)))); break;
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(&vm->stack, 0))) {
-                    runtimeError(vm, "Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(&vm->stack, NUMBER_VAL(-AS_NUMBER(pop(&vm->stack))));
-                break;
-            }
-            case OP_PRINT:
-                printValue(pop(&vm->stack));
-                printf("\n");
-                break;
-            case OP_POP:
-                pop(&vm->stack);
-                break;
-            case OP_DEFINE_GLOBAL: {
-                ObjString* global = AS_STRING(READ_CONSTANT(frame));
-                tableSet(&vm->globals, global, pop(&vm->stack));
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjString* name = AS_STRING(READ_CONSTANT(frame));
-                Value value;
-                if (!tableGet(&vm->globals, name, &value)) {
-                    runtimeError(vm,"Undefined variable '%s.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(&vm->stack, value);
-                break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjString* name = AS_STRING(READ_CONSTANT(frame));
-                if (tableSet(&vm->globals, name, peek(&vm->stack, 0))) {
-                    tableDelete(&vm->globals, name);
-                    runtimeError(vm,"Undefined variable '%s.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE(frame);
-                push(&vm->stack, frame->slots[slot]);
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE(frame);
-                frame->slots[slot] = peek(&vm->stack, 0);
-                break;
-            }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_16_BYTE(frame);
-                frame->ip += (uint16_t)isFalsey(peek(&vm->stack, 0)) * offset;
-                break;
-            }
-            case OP_JUMP: {
-                uint16_t offset = READ_16_BYTE(frame);
-                frame->ip += offset;
-                break;
-            }
-            case OP_LOOP: {
-                uint16_t offset = READ_16_BYTE(frame);
-                frame->ip -= offset;
-                break;
-            }
-            case OP_RETURN: {
-                return INTERPRET_OK;
-            }
-        }
-    }
-}
+
+#define RUN_FUNCTION run
+#define TRACE_INSTRUCTION() do {} while (false)
+#include "run.h"
+#undef RUN_FUNCTION
+#undef TRACE_INSTRUCTION
+
+#define RUN_FUNCTION runTraced
+#define TRACE_INSTRUCTION() \
+    do { \
+        STORE_FRAME(); \
+        printStack(&vm->stack); \
+        disassembleInstruction(&frame->function->chunk, (int)(ip - frame->function->chunk.code)); \
+    } while (false)
+#include "run.h"
+#undef RUN_FUNCTION
+#undef TRACE_INSTRUCTION
+
+#undef READ_BYTE
+#undef READ_16_BYTE
+#undef READ_24_BYTE
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef LOAD_TOP
+#undef SPILL_TOP
+#undef STACK_TOP
+#undef PUSH
+#undef POP
+#undef DROP
+#undef RELOAD_TOP
+#undef TOP
+#undef SECOND
+#undef REPLACE_TOP_TWO
+#undef STORE_FRAME
+#undef RUNTIME_ERROR
+#undef NUMBER_OP
+#undef COMPARE
+#undef GC_SAFEPOINT
+#undef GET_GLOBAL
+#undef SET_GLOBAL
+#undef COMPARISON_OP
+#undef EQUALITY_OP
+#undef THREADED_DISPATCH
+#undef DISPATCH
+#undef CASE
+#undef NEXT
 
 InterpretResult interpret(VM* vm, const char* source) {
+    setAllocatingVM(vm);
     ObjFunction* function = compile(vm, source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
@@ -297,7 +343,7 @@ InterpretResult interpret(VM* vm, const char* source) {
     frame->ip = function->chunk.code;
     frame->slots = vm->stack.values;
 
-    InterpretResult res = run(vm);
+    InterpretResult res = vm->traceExecution ? runTraced(vm) : run(vm);
 
     return res;
 }
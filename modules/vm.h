@@ -5,6 +5,9 @@
 #ifndef CLOX_VM_H
 #define CLOX_VM_H
 
+#include "arena.h"
+#include "nursery.h"
+#include "pool.h"
 #include "common.h"
 #include "chunk.h"
 #include "table.h"
@@ -25,14 +28,73 @@ typedef struct Stack {
     Value* top;
 } Stack;
 
-typedef struct VM {
+typedef enum {
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP,
+} GCPhase;
+
+// Bucket k counts pauses of 2^k to 2^(k+1) microseconds, bucket 0 everything shorter.
+#define GC_PAUSE_BUCKETS 24
+
+typedef struct {
+    uint64_t pauses; // Calls to collectGarbage, minor collections and slices of a cycle included.
+    uint64_t cycles; // Complete mark and sweep cycles over the whole heap.
+    uint64_t totalNanos;
+    uint64_t maxNanos;
+    uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+} GCStats;
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+} ObjTypeStats;
+
+typedef struct {
+    // Bytes through reallocate while this VM was the allocating one. Resizing a block counts the difference.
+    uint64_t allocated;
+    uint64_t freed;
+    uint64_t peak;                         // The most bytes that were ever live at once.
+    ObjTypeStats objects[OBJ_TYPE_COUNT];  // Live objects, young ones included until the nursery is collected.
+    ObjTypeStats young[OBJ_TYPE_COUNT];    // The part of objects that is still in the nursery.
+} MemStats;
+
+struct VM {
     CallFrame frames[FRAMES_MAX];
     int frameCount;
     Stack stack;
     Obj* objects;
+#ifdef POOL_ALLOCATOR
+    Pool pool;             // Where reallocate gets small blocks from when built with POOL_ALLOCATOR.
+#endif
+    size_t bytesAllocated; // Everything allocated through reallocate while this VM was the allocating one.
+    size_t nextGC;
+    int grayCount;
+    int grayCapacity;
+    Obj** grayStack;       // Marked objects whose references haven't been marked yet.
+    // Where the collector is in a cycle over the whole heap. Only INCREMENTAL_GC leaves a cycle half done.
+    GCPhase gcPhase;
+    Obj* sweepCursor;      // The rest of the objects a sweep in progress hasn't looked at yet.
+    int gcPauseBudget;     // Microseconds per pause with INCREMENTAL_GC, set with setGCPauseBudget.
+    GCStats gcStats;
+    MemStats memStats;
+    Arena stringArena; // Where small strings are allocated when built with STRING_ARENA.
+#ifdef NURSERY
+    Nursery nursery;   // Where strings and ropes start out when built with NURSERY.
+#endif
     Table strings;
+    uint64_t hashSeed; // Seeds hashString for every string of this VM, picked at random by initVM.
+
+    // Every global name the compiler has seen gets a slot in globalValues. globals maps the name to its
+    // slot and globalNames maps the slot back to the name for error messages. A slot holds UNDEFINED_VAL
+    // until the variable is defined.
     Table globals;
-} VM;
+    ValueArray globalNames;
+    ValueArray globalValues;
+
+    bool traceExecution; // Print the stack and the instruction before executing it.
+    bool printCode;      // Disassemble every chunk after compiling it.
+};
 
 void push(Stack* stack, Value value);
 
@@ -47,6 +109,8 @@ typedef enum {
 VM* initVM();
 void freeVM(VM*);
 
+int globalSlot(VM* vm, ObjString* name);
+
 InterpretResult interpret(VM* vm, const char* source);
 
 #endif //CLOX_VM_H
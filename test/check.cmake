@@ -0,0 +1,16 @@
+# Runs one script and compares what it prints with the .out file next to it.
+#
+#   cmake -DCLOX=<clox> -DSCRIPT=<script.lox> -P test/check.cmake
+
+get_filename_component(dir "${SCRIPT}" DIRECTORY)
+get_filename_component(name "${SCRIPT}" NAME_WE)
+
+execute_process(COMMAND "${CLOX}" "${SCRIPT}" RESULT_VARIABLE status OUTPUT_VARIABLE actual ERROR_VARIABLE errors)
+if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${name}.lox exited with ${status}:\n${errors}")
+endif()
+
+file(READ "${dir}/${name}.out" expected)
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${name}.lox printed:\n${actual}\nexpected:\n${expected}")
+endif()
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds clox with GC_STRESS and AddressSanitizer once per configuration and runs the tests with each build.
+# Under GC_STRESS every safepoint collects and the nursery is poisoned after a minor collection, so a missing
+# root or write barrier shows up as a wrong answer or an ASan report instead of going unnoticed.
+#
+#   test/run.sh                                        # nursery, incremental GC and allocator, both ways each
+#   test/run.sh "-DNURSERY=OFF" "-DSWISS_TABLE=ON"     # any list of cmake option sets
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+if [ $# -eq 0 ]; then
+    for nursery in ON OFF; do
+        for incremental in ON OFF; do
+            for allocator in pool libc; do
+                set -- "$@" "-DNURSERY=$nursery -DINCREMENTAL_GC=$incremental -DALLOCATOR=$allocator"
+            done
+        done
+    done
+fi
+
+n=0
+failed=0
+for config in "$@"; do
+    n=$((n + 1))
+    build="$ROOT/_test_build/$n"
+    rm -f "$build/CMakeCache.txt"
+    cmake -S "$ROOT" -B "$build" -DGC_STRESS=ON -DCMAKE_C_FLAGS="-fsanitize=address,undefined -g" $config > /dev/null
+    cmake --build "$build" > /dev/null 2>&1
+
+    echo "== ${config:-default}"
+    if ctest --test-dir "$build" --output-on-failure > "$build/ctest.log"; then
+        tail -n 3 "$build/ctest.log" | head -n 1
+    else
+        cat "$build/ctest.log"
+        failed=1
+    fi
+done
+exit $failed
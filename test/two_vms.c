@@ -0,0 +1,41 @@
+// Two VMs alive at once, freed while the other one is the allocating VM. Each VM has its own heap, so
+// freeing one must neither give its memory to the pool of the other nor stop the other from running.
+//
+// Run by ctest. Under test/run.sh it is built with AddressSanitizer, which catches a block freed into the
+// wrong pool.
+
+#include <stdio.h>
+
+#include "../modules/vm.h"
+
+#define SCRIPT \
+    "var s = \"\";" \
+    "for (var i = 0; i < 200; i = i + 1) s = s + \"-\" + \"block\";" \
+    "var t = s + \"!\";"
+
+static int check(const char* what, InterpretResult result) {
+    if (result == INTERPRET_OK) return 0;
+    fprintf(stderr, "%s failed with %d.\n", what, result);
+    return 1;
+}
+
+int main() {
+    VM* a = initVM();
+    VM* b = initVM();
+    int failed = 0;
+
+    failed |= check("a", interpret(a, SCRIPT));
+    failed |= check("b", interpret(b, SCRIPT));
+
+    // b is the allocating VM now.
+    size_t bytes = b->bytesAllocated;
+    freeVM(a);
+    if (b->bytesAllocated != bytes) {
+        fprintf(stderr, "Freeing a was charged to b.\n");
+        failed = 1;
+    }
+
+    failed |= check("b after freeing a", interpret(b, "var u = t + s; print u == t + s;"));
+    freeVM(b);
+    return failed;
+}